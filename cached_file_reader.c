@@ -2,8 +2,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+#endif
 #include "vgm_conf.h"
 #include "cached_file_reader.h"
+#include "reader_stats.h"
+#include "pread_full.h"
+
+
+// Blocks per set. Block count given to cfreader_create is rounded down to multiple of this
+#define CFR_CACHE_WAYS  4
+
+
+// One cached block of file data
+typedef struct cfr_block_s
+{
+    size_t tag;             // block number (file offset / block_size), (size_t)-1 if empty
+    size_t length;          // valid bytes, less than block_size only for the last block of file
+    unsigned long stamp;    // last access time for LRU
+    bool loaded;            // filled by the readv in progress, reads from it count as misses
+    uint8_t* data;
+} cfr_block_t;
 
 
 // Cached File Reader
@@ -12,179 +37,375 @@ typedef struct cfr_s
     // super class
     file_reader_t super;
     // Private fields
-    FILE* fd;
-    uint8_t* cache;
-    size_t cache_size;
-    size_t cache_length;
-    size_t cache_offset;
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-    unsigned long long cache_hit;
-    unsigned long long cache_miss;
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int fd;
 #endif
+    size_t file_size;       // captured at open
+    size_t pos;             // logical position, end of last read
+    uint8_t* cache;
+    cfr_block_t* blocks;
+    size_t block_size;
+    size_t ways;
+    size_t sets;
+    unsigned long clock;
+    reader_stats_t stats;
 } cfr_t;
 
 
+// Nothing is read past end of file
 static size_t read_direct(cfr_t *ctx, uint8_t *out, size_t offset, size_t length)
 {
-    size_t read = 0, total = 0;
-     if (offset != ftell(ctx->fd))
-        fseek(ctx->fd, (long)offset, SEEK_SET);
-    while (length > ctx->cache_size)
-    {
-        read = fread(out, 1, ctx->cache_size, ctx->fd);
-        if (0 == read) break;
-        out += read;
-        total += read;
-        offset += read;
-        length -= read;
-    }
-    if (length > 0)
+#ifdef _WIN32
+    return pread_full(ctx->file, out, offset, length, ctx->file_size, &ctx->stats);
+#else
+    return pread_full(ctx->fd, out, offset, length, ctx->file_size, &ctx->stats);
+#endif
+}
+
+
+static cfr_block_t * lookup(cfr_t *ctx, size_t tag)
+{
+    cfr_block_t *set = ctx->blocks + (tag % ctx->sets) * ctx->ways;
+    for (size_t i = 0; i < ctx->ways; ++i)
     {
-        read = fread(ctx->cache, 1, ctx->cache_size, ctx->fd);
-        if (read > 0)
+        if (set[i].tag == tag)
         {
-            ctx->cache_offset = offset;
-            ctx->cache_length = read;
-            length = length > read ? read : length;
-            memcpy(out, ctx->cache, length);
-            total += length;
+            set[i].stamp = ++ctx->clock;
+            return set + i;
         }
     }
-    return total;
+    return 0;
+}
+
+
+// Least recently used way of the set of block
+static cfr_block_t * evict(cfr_t *ctx, size_t tag)
+{
+    cfr_block_t *set = ctx->blocks + (tag % ctx->sets) * ctx->ways;
+    cfr_block_t *victim = set;
+    for (size_t i = 1; i < ctx->ways; ++i)
+    {
+        if (set[i].stamp < victim->stamp)
+            victim = set + i;
+    }
+    return victim;
 }
 
 
-/*                                                  off    len   o_c_s   c_s   o_c_l
- *  cache off=4,len=3          |4|5|6|                                     
- *  read (1, 3)          |1|2|3|                     1      3      x      x      x
- *  read (1, 4)          |1|2|3|4|                   1      4      3      0      1
- *  read (4, 1)                |4|                   4      1      0      0      1
- *  read (6, 1)                    |6|               6      1      0      2      1
- *  read (4, 3)                |4|5|6|               4      3      0      0      3
- *  read (2, 6)            |2|3|4|5|6|7|             2      6      2      0      3
- *  read (6, 1)                    |6|               6      1      0      2      1
- *  read (6, 3)                    |6|7|8|           6      3      0      2      1
- *  read (7, 3)                      |7|8|9|         7      3      x      x      x
+// Load block into least recently used way of its set
+static cfr_block_t * fill(cfr_t *ctx, size_t tag)
+{
+    cfr_block_t *victim = evict(ctx, tag);
+    victim->length = read_direct(ctx, victim->data, tag * ctx->block_size, ctx->block_size);
+    victim->loaded = false;
+    if (0 == victim->length)
+    {
+        victim->tag = (size_t)-1;
+        victim->stamp = 0;
+        return 0;
+    }
+    victim->tag = tag;
+    victim->stamp = ++ctx->clock;
+    return victim;
+}
+
+
+/*
+ * File is divided into fixed size blocks. Block n can live in any way of set (n % sets).
+ * A request is served block by block from the cache, missing blocks are loaded into the
+ * least recently used way of their set. Requests covering whole blocks which are not
+ * resident bypass the cache so bulk reads do not evict the command stream.
+ * Position and file size are tracked here, a cache hit makes no system call at all.
+ *
+ *  block_size=4, request (6, 9)    |4 5 6 7|8 9 A B|C D E F|
+ *                                       ^-----------------^
+ *                                   tail of    whole     head of
+ *                                   block 1    block 2   block 3
  */
 
-static size_t read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+static size_t cfr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
 {
     cfr_t *ctx = (cfr_t *)self;
-    size_t o_c_s; // out_cached_start
-    size_t o_c_l; // out_cached_length
-    size_t c_s;   // cached_start
-    size_t total = 0, temp;
-
-    if (length == 0)
-        return 0;
+    cfr_block_t *blk;
+    size_t tag, b_o;    // block number and offset within block
+    size_t total = 0, temp, start, requested = length;
+    int hit;
 
     if ((size_t)-1 == offset)
-        offset = (size_t)ftell(ctx->fd);
+        offset = ctx->pos;
+    start = offset;
+    if (offset >= ctx->file_size)
+        length = 0;
+    else if (length > ctx->file_size - offset)
+        length = ctx->file_size - offset;
 
-    // Check if reqest data is already in cache (or part of)
-    if ((ctx->cache_length > 0) && (offset + length > ctx->cache_offset) && (offset < ctx->cache_offset + ctx->cache_length))
+    while (length > 0)
     {
-        o_c_s = (offset > ctx->cache_offset) ? 0 : (ctx->cache_offset - offset);
-        c_s = offset + o_c_s - ctx->cache_offset;
-        if (length - o_c_s > ctx->cache_length - c_s)
-            o_c_l = ctx->cache_length - c_s;
+        tag = offset / ctx->block_size;
+        b_o = offset - tag * ctx->block_size;
+        blk = lookup(ctx, tag);
+        hit = (blk != 0);
+        if (!hit && (0 == b_o) && (length >= ctx->block_size))
+        {
+            // whole blocks not in cache, read directly to output
+            temp = length - length % ctx->block_size;
+            temp = read_direct(ctx, out, offset, temp);
+            ctx->stats.cache_miss += temp;
+            total += temp;
+            if (temp < length - length % ctx->block_size)
+                break;  // end of file
+            out += temp;
+            offset += temp;
+            length -= temp;
+            continue;
+        }
+        if (!hit)
+        {
+            blk = fill(ctx, tag);
+            if (0 == blk)
+                break;  // end of file or read error
+        }
+        if (b_o >= blk->length)
+            break;      // offset beyond end of file
+        temp = blk->length - b_o;
+        if (temp > length)
+            temp = length;
+        // transfer from cache to output
+        memcpy(out, blk->data + b_o, temp);
+        ctx->stats.bytes_copied += temp;
+        if (hit && !blk->loaded)
+            ctx->stats.cache_hit += temp;
         else
-            o_c_l = length - o_c_s;
-        // transfer from catch to output
-        memcpy(out + o_c_s, ctx->cache + c_s, o_c_l);
-        total += o_c_l;
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-        ctx->cache_hit += o_c_l;
-#endif
-    }
-    else
-    {
-        // cache miss, fetch fresh data
-        temp = read_direct(ctx, out, offset, length);
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-        ctx->cache_miss += temp;
-#endif
-        return temp;
+            ctx->stats.cache_miss += temp;
+        total += temp;
+        out += temp;
+        offset += temp;
+        length -= temp;
+        if (blk->length < ctx->block_size)
+            break;      // last block of file
     }
-    // fetch data before cached region
-    if (o_c_s > 0)
+
+    ctx->pos = offset;
+    reader_stats_count_read(&ctx->stats, start, requested, total);
+    return total;
+}
+
+
+static int cmp_tag(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/*
+ * Vectored read. The missing blocks of all ranges are collected first, runs of consecutive
+ * missing blocks are loaded with a single read each, then every range is served by cfr_read()
+ * from the cache. Ranges larger than the cache only contribute their partial head and tail
+ * blocks, whole blocks in between still bypass the cache. Bytes served from blocks loaded
+ * here count as misses, not hits.
+ *
+ *  ranges (0, 6) (9, 2) (13, 2)    |0 1 2 3|4 5 6 7|8 9 A B|C D E F|
+ *                                   ^---------^       ^-^     ^-^
+ *  missing blocks 0, 1, 2, 3 are loaded by one 16 byte read
+ */
+
+static size_t cfr_readv(file_reader_t *self, file_range_t *ranges, size_t count)
+{
+    cfr_t *ctx = (cfr_t *)self;
+    size_t capacity = ctx->sets * ctx->ways;
+    size_t *tags, n = 0, total = 0;
+    uint8_t *run;
+
+    tags = (size_t*)VGM_MALLOC(sizeof(size_t) * capacity);
+    run = (uint8_t*)VGM_MALLOC(ctx->block_size * capacity);
+    if (tags && run)
     {
-        temp = read_direct(ctx, out, offset, o_c_s);
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-        ctx->cache_miss += temp;
-#endif
-        total += temp;
+        for (size_t i = 0; (i < count) && (n + 2 <= capacity); ++i)
+        {
+            size_t first, last, b_o;
+            if (0 == ranges[i].length)
+                continue;
+            first = ranges[i].offset / ctx->block_size;
+            last = (ranges[i].offset + ranges[i].length - 1) / ctx->block_size;
+            b_o = ranges[i].offset - first * ctx->block_size;
+            if (n + last - first + 1 <= capacity)
+            {
+                // Range fits in cache, take all its blocks so neighbours merge into one run
+                for (size_t tag = first; tag <= last; ++tag)
+                {
+                    if (!lookup(ctx, tag))
+                        tags[n++] = tag;
+                }
+                continue;
+            }
+            if (((b_o != 0) || (ranges[i].length < ctx->block_size)) && !lookup(ctx, first))
+                tags[n++] = first;
+            if ((last != first) && ((ranges[i].offset + ranges[i].length) % ctx->block_size != 0) && !lookup(ctx, last))
+                tags[n++] = last;
+        }
+        qsort(tags, n, sizeof(size_t), cmp_tag);
+        for (size_t i = 0, j; i < n; i = j)
+        {
+            size_t length;
+            // tags[i..j) are consecutive blocks, duplicates skipped
+            for (j = i + 1; (j < n) && (tags[j] <= tags[j - 1] + 1); ++j)
+                ;
+            length = read_direct(ctx, run, tags[i] * ctx->block_size, (tags[j - 1] - tags[i] + 1) * ctx->block_size);
+            for (size_t k = i; k < j; ++k)
+            {
+                size_t b_o = (tags[k] - tags[i]) * ctx->block_size;
+                cfr_block_t *blk;
+                if ((k > i) && (tags[k] == tags[k - 1]))
+                    continue;
+                if (b_o >= length)
+                    break;
+                blk = evict(ctx, tags[k]);
+                blk->length = (length - b_o < ctx->block_size) ? length - b_o : ctx->block_size;
+                memcpy(blk->data, run + b_o, blk->length);
+                blk->tag = tags[k];
+                blk->stamp = ++ctx->clock;
+                blk->loaded = true;
+            }
+        }
     }
-    // fetch data after cached region
-    if (length > o_c_s + o_c_l)
+    if (tags)
+        VGM_FREE(tags);
+    if (run)
+        VGM_FREE(run);
+
+    for (size_t i = 0; i < count; ++i)
     {
-        temp = read_direct(ctx, out + o_c_s + o_c_l, offset + o_c_s + o_c_l, length - o_c_s - o_c_l);
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-        ctx->cache_miss += temp;
-#endif
-        total += temp;        
+        ranges[i].result = cfr_read(self, ranges[i].out, ranges[i].offset, ranges[i].length);
+        total += ranges[i].result;
     }
-    
+    for (size_t i = 0; i < capacity; ++i)
+        ctx->blocks[i].loaded = false;
     return total;
 }
 
 
-static size_t size(file_reader_t *self)
+static size_t cfr_size(file_reader_t *self)
 {
     cfr_t *ctx = (cfr_t*)self;
-    if (ctx && ctx->fd)
-    {
-        fseek(ctx->fd, 0, SEEK_END);
-        long len = ftell(ctx->fd);
-        return (size_t)len;
-    }
-    return 0;
+    return ctx ? ctx->file_size : 0;
+}
+
+
+static void cfr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    cfr_t *ctx = (cfr_t*)self;
+    *out = ctx->stats;
+}
+
+
+
+#ifdef _WIN32
+
+static bool open_file(cfr_t *ctx, const char *fn)
+{
+    LARGE_INTEGER len;
+    ctx->file = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == ctx->file)
+        return false;
+    if (!GetFileSizeEx(ctx->file, &len))
+        return false;
+    ctx->file_size = (size_t)len.QuadPart;
+    return true;
+}
+
+
+static void close_file(cfr_t *ctx)
+{
+    if (INVALID_HANDLE_VALUE != ctx->file)
+        CloseHandle(ctx->file);
+}
+
+#else
+
+static bool open_file(cfr_t *ctx, const char *fn)
+{
+    struct stat st;
+    ctx->fd = open(fn, O_RDONLY);
+    if (ctx->fd < 0)
+        return false;
+    if (fstat(ctx->fd, &st) != 0)
+        return false;
+    ctx->file_size = (size_t)st.st_size;
+    return true;
+}
+
+
+static void close_file(cfr_t *ctx)
+{
+    if (ctx->fd >= 0)
+        close(ctx->fd);
 }
 
+#endif
 
 
-file_reader_t * cfreader_create(const char* fn, size_t cache_size)
+file_reader_t * cfreader_create(const char* fn, size_t block_size, size_t block_count)
 {
-    FILE *fd = 0;
     cfr_t *ctx = 0;
-    
+    size_t ways;
+
+    if ((0 == block_size) || (0 == block_count))
+        return 0;
+    ways = (block_count < CFR_CACHE_WAYS) ? block_count : CFR_CACHE_WAYS;
+    block_count -= block_count % ways;
+
+    ctx = (cfr_t*)VGM_MALLOC(sizeof(cfr_t));
+    if (0 == ctx)
+        return 0;
+    ctx->blocks = 0;
+    ctx->cache = 0;
+
     do
     {
-        fd = fopen(fn, "rb");
-        if (0 == fd)
+        // File size is taken once here, size() and reads never ask the system again
+        if (!open_file(ctx, fn))
             break;
 
-        ctx = (cfr_t*)VGM_MALLOC(sizeof(cfr_t));
-        if (0 == ctx)
+        ctx->cache = (uint8_t*)VGM_MALLOC(block_size * block_count);
+        if (0 == ctx->cache)
             break;
 
-        ctx->cache = (uint8_t*)VGM_MALLOC(cache_size);
-        if (0 == ctx->cache)
+        ctx->blocks = (cfr_block_t*)VGM_MALLOC(sizeof(cfr_block_t) * block_count);
+        if (0 == ctx->blocks)
             break;
 
-        ctx->fd = fd;
-        ctx->cache_size = cache_size;
-        ctx->cache_length = 0;
-        ctx->cache_offset = 0;
+        for (size_t i = 0; i < block_count; ++i)
+        {
+            ctx->blocks[i].tag = (size_t)-1;
+            ctx->blocks[i].length = 0;
+            ctx->blocks[i].stamp = 0;
+            ctx->blocks[i].loaded = false;
+            ctx->blocks[i].data = ctx->cache + i * block_size;
+        }
+
+        ctx->pos = 0;
+        ctx->block_size = block_size;
+        ctx->ways = ways;
+        ctx->sets = block_count / ways;
+        ctx->clock = 0;
 
         ctx->super.self = (file_reader_t*)ctx;
-        ctx->super.read = read;
-        ctx->super.size = size;
+        ctx->super.read = cfr_read;
+        ctx->super.size = cfr_size;
+        ctx->super.borrow = 0;
+        ctx->super.destroy = cfreader_destroy;
+        ctx->super.stats = cfr_stats;
+        ctx->super.readv = cfr_readv;
 
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-        ctx->cache_hit = 0;
-        ctx->cache_miss = 0;
-#endif
+        reader_stats_reset(&ctx->stats);
         return (file_reader_t*)ctx;
 
     } while (0);
 
-    if (ctx && ctx->cache)
-        VGM_FREE(ctx->cache);
-    if (ctx)
-        VGM_FREE(ctx);
-    if (fd)
-        fclose(fd);
+    cfreader_destroy((file_reader_t*)ctx);
     return 0;
 }
 
@@ -194,20 +415,10 @@ void cfreader_destroy(file_reader_t *cfr)
     cfr_t* ctx = (cfr_t*)cfr;
     if (0 == ctx)
         return;
+    if (ctx->blocks)
+        VGM_FREE(ctx->blocks);
     if (ctx->cache)
         VGM_FREE(ctx->cache);
-    if (ctx->fd)
-        fclose(ctx->fd);
+    close_file(ctx);
     VGM_FREE(ctx);
 }
-
-
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-
-void cfreader_show_cache_status(file_reader_t* cfr)
-{
-    cfr_t *ctx = (cfr_t *)cfr;
-    VGM_PRINTF("Cache Status: (%llu/%llu), hit %.1f%%\n", ctx->cache_hit, ctx->cache_hit + ctx->cache_miss, ((double)(ctx->cache_hit) * 100.0f) / (double)(ctx->cache_hit + ctx->cache_miss));
-}
-
-#endif
\ No newline at end of file
@@ -7,23 +7,14 @@ extern "C" {
 #endif
 
 
-#define CFR_MEASURE_CACHE_PERFORMACE
-
-
-file_reader_t * cfreader_create(const char* fn, size_t cache_size);
+// Create reader with a set-associative cache of block_count blocks, block_size bytes each.
+// Blocks are replaced least recently used first within their set.
+// File size is taken at open and the position is tracked by the reader, misses are served
+// with one positional read and a cache hit makes no system call.
+file_reader_t * cfreader_create(const char* fn, size_t block_size, size_t block_count);
 
 void cfreader_destroy(file_reader_t* cfr);
 
-#ifdef CFR_MEASURE_CACHE_PERFORMACE
-
-void cfreader_show_cache_status(file_reader_t* cfr);
-
-#else
-
-#define cfr_show_cache_status(x) void(x)
-
-#endif
-
 
 #ifdef __cplusplus
 }
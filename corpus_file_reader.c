@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_conf.h"
+#include "corpus_file_reader.h"
+#include "reader_stats.h"
+#include "lz4blk.h"
+
+
+// One file in corpus, compressed block n is data[index[n]] .. data[index[n + 1]]
+typedef struct corpus_entry_s
+{
+    char* name;
+    size_t size;
+    size_t blocks;
+    uint32_t* index;
+    uint8_t* data;
+} corpus_entry_t;
+
+
+struct corpus_s
+{
+    corpus_entry_t** entries;
+    size_t count;
+    size_t capacity;
+    size_t memory;
+    size_t raw_size;
+};
+
+
+typedef struct crr_slot_s
+{
+    size_t block;           // block number, (size_t)-1 if empty
+    size_t length;
+    unsigned long stamp;    // last access time for LRU
+    uint8_t* data;
+} crr_slot_t;
+
+
+// Corpus File Reader
+typedef struct crr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    const corpus_entry_t* entry;
+    crr_slot_t* slots;
+    size_t slot_count;
+    uint8_t* cache;
+    unsigned long clock;
+    size_t pos;
+    reader_stats_t stats;
+} crr_t;
+
+
+static size_t block_length(const corpus_entry_t *e, size_t block)
+{
+    size_t offset = block * CORPUS_BLOCK_SIZE;
+    return (e->size - offset < CORPUS_BLOCK_SIZE) ? e->size - offset : CORPUS_BLOCK_SIZE;
+}
+
+
+// Decompress block into out, returns false if block is corrupt
+static bool unpack(const corpus_entry_t *e, size_t block, uint8_t *out)
+{
+    const uint8_t *src = e->data + e->index[block];
+    int packed = (int)(e->index[block + 1] - e->index[block]);
+    int length = (int)block_length(e, block);
+    if (packed == length)
+    {
+        memcpy(out, src, (size_t)length);
+        return true;
+    }
+    return lz4blk_decompress(src, packed, out, length) == length;
+}
+
+
+static crr_slot_t * lookup(crr_t *ctx, size_t block)
+{
+    for (size_t i = 0; i < ctx->slot_count; ++i)
+    {
+        if (ctx->slots[i].block == block)
+        {
+            ctx->slots[i].stamp = ++ctx->clock;
+            return ctx->slots + i;
+        }
+    }
+    return 0;
+}
+
+
+// Decompress block into least recently used slot
+static crr_slot_t * fill(crr_t *ctx, size_t block)
+{
+    crr_slot_t *victim = ctx->slots;
+    for (size_t i = 1; i < ctx->slot_count; ++i)
+    {
+        if (ctx->slots[i].stamp < victim->stamp)
+            victim = ctx->slots + i;
+    }
+    if (!unpack(ctx->entry, block, victim->data))
+    {
+        victim->block = (size_t)-1;
+        victim->stamp = 0;
+        return 0;
+    }
+    victim->block = block;
+    victim->length = block_length(ctx->entry, block);
+    victim->stamp = ++ctx->clock;
+    return victim;
+}
+
+
+static size_t crr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    crr_t *ctx = (crr_t *)self;
+    const corpus_entry_t *e = ctx->entry;
+    crr_slot_t *slot;
+    size_t block, b_o, total = 0, temp, start, requested = length;
+    bool hit;
+
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    start = offset;
+    if (offset >= e->size)
+        length = 0;
+    else if (length > e->size - offset)
+        length = e->size - offset;
+
+    while (length > 0)
+    {
+        block = offset / CORPUS_BLOCK_SIZE;
+        b_o = offset - block * CORPUS_BLOCK_SIZE;
+        slot = lookup(ctx, block);
+        hit = (slot != 0);
+        if (!hit && (0 == b_o) && (length >= block_length(e, block)))
+        {
+            // Whole block, decompress straight to output
+            temp = block_length(e, block);
+            if (!unpack(e, block, out))
+                break;
+            ctx->stats.cache_miss += temp;
+        }
+        else
+        {
+            if (!hit && (0 == (slot = fill(ctx, block))))
+                break;
+            temp = slot->length - b_o;
+            if (temp > length)
+                temp = length;
+            memcpy(out, slot->data + b_o, temp);
+            ctx->stats.bytes_copied += temp;
+            if (hit)
+                ctx->stats.cache_hit += temp;
+            else
+                ctx->stats.cache_miss += temp;
+        }
+        total += temp;
+        out += temp;
+        offset += temp;
+        length -= temp;
+    }
+
+    ctx->pos = offset;
+    reader_stats_count_read(&ctx->stats, start, requested, total);
+    return total;
+}
+
+
+static size_t crr_size(file_reader_t *self)
+{
+    crr_t *ctx = (crr_t *)self;
+    return ctx ? ctx->entry->size : 0;
+}
+
+
+static void crr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((crr_t *)self)->stats;
+}
+
+
+static void free_entry(corpus_entry_t *e)
+{
+    if (e->name)
+        VGM_FREE(e->name);
+    if (e->index)
+        VGM_FREE(e->index);
+    if (e->data)
+        VGM_FREE(e->data);
+    VGM_FREE(e);
+}
+
+
+// Take over a completed entry
+static bool add_entry(corpus_t *corpus, corpus_entry_t *e)
+{
+    if (corpus->count == corpus->capacity)
+    {
+        size_t capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+        corpus_entry_t **entries = (corpus_entry_t**)VGM_MALLOC(sizeof(corpus_entry_t*) * capacity);
+        if (0 == entries)
+            return false;
+        if (corpus->entries)
+        {
+            memcpy(entries, corpus->entries, sizeof(corpus_entry_t*) * corpus->count);
+            VGM_FREE(corpus->entries);
+        }
+        corpus->entries = entries;
+        corpus->capacity = capacity;
+    }
+    corpus->entries[corpus->count++] = e;
+    corpus->memory += e->index[e->blocks] + sizeof(uint32_t) * (e->blocks + 1);
+    corpus->raw_size += e->size;
+    return true;
+}
+
+
+// Compress blocks pulled from source into a new entry. source fills up to CORPUS_BLOCK_SIZE
+// bytes and returns the count, less only at end of data
+static corpus_entry_t * pack_entry(const char *name, size_t size, size_t (*source)(void *arg, uint8_t *block), void *arg)
+{
+    corpus_entry_t *e;
+    uint8_t block[CORPUS_BLOCK_SIZE];
+    uint8_t *packed = 0;
+    size_t used = 0;
+
+    e = (corpus_entry_t*)VGM_MALLOC(sizeof(corpus_entry_t));
+    if (0 == e)
+        return 0;
+    memset(e, 0, sizeof(corpus_entry_t));
+
+    do
+    {
+        e->name = (char*)VGM_MALLOC(strlen(name) + 1);
+        if (0 == e->name)
+            break;
+        strcpy(e->name, name);
+        e->size = size;
+        e->blocks = (size + CORPUS_BLOCK_SIZE - 1) / CORPUS_BLOCK_SIZE;
+        // Index holds 32 bit offsets
+        if (e->blocks > UINT32_MAX / LZ4BLK_BOUND(CORPUS_BLOCK_SIZE))
+            break;
+        e->index = (uint32_t*)VGM_MALLOC(sizeof(uint32_t) * (e->blocks + 1));
+        // Worst case for all blocks, trimmed to actual size below
+        packed = (uint8_t*)VGM_MALLOC(e->blocks * LZ4BLK_BOUND(CORPUS_BLOCK_SIZE) + 1);
+        if ((0 == e->index) || (0 == packed))
+            break;
+
+        size_t n;
+        for (n = 0; n < e->blocks; ++n)
+        {
+            size_t length = block_length(e, n);
+            int r;
+            if (source(arg, block) != length)
+                break;
+            e->index[n] = (uint32_t)used;
+            r = lz4blk_compress(block, (int)length, packed + used, LZ4BLK_BOUND(CORPUS_BLOCK_SIZE));
+            if ((r <= 0) || ((size_t)r >= length))
+            {
+                // Store as is, unpack() recognises blocks of full length
+                memcpy(packed + used, block, length);
+                r = (int)length;
+            }
+            used += (size_t)r;
+        }
+        if (n < e->blocks)
+            break;
+        e->index[e->blocks] = (uint32_t)used;
+
+        e->data = (uint8_t*)VGM_MALLOC(used + 1);
+        if (0 == e->data)
+            break;
+        memcpy(e->data, packed, used);
+        VGM_FREE(packed);
+        return e;
+    } while (0);
+
+    if (packed)
+        VGM_FREE(packed);
+    free_entry(e);
+    return 0;
+}
+
+
+typedef struct buffer_source_s
+{
+    const uint8_t* data;
+    size_t length;
+} buffer_source_t;
+
+
+static size_t from_buffer(void *arg, uint8_t *block)
+{
+    buffer_source_t *src = (buffer_source_t *)arg;
+    size_t n = (src->length < CORPUS_BLOCK_SIZE) ? src->length : CORPUS_BLOCK_SIZE;
+    memcpy(block, src->data, n);
+    src->data += n;
+    src->length -= n;
+    return n;
+}
+
+
+static size_t from_file(void *arg, uint8_t *block)
+{
+    return fread(block, 1, CORPUS_BLOCK_SIZE, (FILE *)arg);
+}
+
+
+corpus_t * corpus_create(void)
+{
+    corpus_t *corpus = (corpus_t*)VGM_MALLOC(sizeof(corpus_t));
+    if (corpus)
+        memset(corpus, 0, sizeof(corpus_t));
+    return corpus;
+}
+
+
+void corpus_destroy(corpus_t* corpus)
+{
+    if (0 == corpus)
+        return;
+    for (size_t i = 0; i < corpus->count; ++i)
+        free_entry(corpus->entries[i]);
+    if (corpus->entries)
+        VGM_FREE(corpus->entries);
+    VGM_FREE(corpus);
+}
+
+
+bool corpus_add_buffer(corpus_t* corpus, const char* name, const uint8_t* data, size_t length)
+{
+    buffer_source_t src;
+    corpus_entry_t *e;
+    src.data = data;
+    src.length = length;
+    e = pack_entry(name, length, from_buffer, &src);
+    if (e && add_entry(corpus, e))
+        return true;
+    if (e)
+        free_entry(e);
+    return false;
+}
+
+
+bool corpus_add(corpus_t* corpus, const char* name, const char* fn)
+{
+    corpus_entry_t *e = 0;
+    long length;
+    FILE *fd = fopen(fn, "rb");
+    if (0 == fd)
+        return false;
+    if ((0 == fseek(fd, 0, SEEK_END)) && ((length = ftell(fd)) >= 0) && (0 == fseek(fd, 0, SEEK_SET)))
+        e = pack_entry(name, (size_t)length, from_file, fd);
+    fclose(fd);
+    if (e && add_entry(corpus, e))
+        return true;
+    if (e)
+        free_entry(e);
+    return false;
+}
+
+
+size_t corpus_memory(corpus_t* corpus)
+{
+    return corpus ? corpus->memory : 0;
+}
+
+
+size_t corpus_raw_size(corpus_t* corpus)
+{
+    return corpus ? corpus->raw_size : 0;
+}
+
+
+file_reader_t * corpus_reader_create(corpus_t* corpus, const char* name, size_t cache_blocks)
+{
+    const corpus_entry_t *e = 0;
+    crr_t *ctx;
+
+    if ((0 == corpus) || (0 == name) || (0 == cache_blocks))
+        return 0;
+    for (size_t i = 0; i < corpus->count; ++i)
+    {
+        if (0 == strcmp(corpus->entries[i]->name, name))
+        {
+            e = corpus->entries[i];
+            break;
+        }
+    }
+    if (0 == e)
+        return 0;
+
+    ctx = (crr_t*)VGM_MALLOC(sizeof(crr_t));
+    if (0 == ctx)
+        return 0;
+    ctx->slots = (crr_slot_t*)VGM_MALLOC(sizeof(crr_slot_t) * cache_blocks);
+    ctx->cache = (uint8_t*)VGM_MALLOC(CORPUS_BLOCK_SIZE * cache_blocks);
+    if ((0 == ctx->slots) || (0 == ctx->cache))
+    {
+        if (ctx->slots) VGM_FREE(ctx->slots);
+        if (ctx->cache) VGM_FREE(ctx->cache);
+        VGM_FREE(ctx);
+        return 0;
+    }
+    for (size_t i = 0; i < cache_blocks; ++i)
+    {
+        ctx->slots[i].block = (size_t)-1;
+        ctx->slots[i].length = 0;
+        ctx->slots[i].stamp = 0;
+        ctx->slots[i].data = ctx->cache + i * CORPUS_BLOCK_SIZE;
+    }
+    ctx->entry = e;
+    ctx->slot_count = cache_blocks;
+    ctx->clock = 0;
+    ctx->pos = 0;
+    reader_stats_reset(&ctx->stats);
+
+    ctx->super.self = (file_reader_t*)ctx;
+    ctx->super.read = crr_read;
+    ctx->super.size = crr_size;
+    ctx->super.borrow = 0;
+    ctx->super.destroy = corpus_reader_destroy;
+    ctx->super.stats = crr_stats;
+    ctx->super.readv = 0;
+
+    return (file_reader_t*)ctx;
+}
+
+
+void corpus_reader_destroy(file_reader_t *crr)
+{
+    crr_t* ctx = (crr_t*)crr;
+    if (0 == ctx)
+        return;
+    VGM_FREE(ctx->slots);
+    VGM_FREE(ctx->cache);
+    VGM_FREE(ctx);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Compressed in-memory corpus. Every file added is kept as independently LZ4 compressed
+// blocks of CORPUS_BLOCK_SIZE bytes plus a block index. A reader on a corpus file only
+// decompresses the blocks a read touches, through a small cache of decompressed blocks of
+// its own, so any number of readers may share one corpus from different threads.
+// Blocks which do not compress are stored as is.
+
+#define CORPUS_BLOCK_SIZE   4096
+
+typedef struct corpus_s corpus_t;
+
+corpus_t * corpus_create(void);
+
+// All readers created on the corpus must be destroyed before destroying it
+void corpus_destroy(corpus_t* corpus);
+
+// Compress file fn into corpus under name. Not thread safe with readers being created
+bool corpus_add(corpus_t* corpus, const char* name, const char* fn);
+
+bool corpus_add_buffer(corpus_t* corpus, const char* name, const uint8_t* data, size_t length);
+
+// Memory held by compressed data and index, and total size of the files added
+size_t corpus_memory(corpus_t* corpus);
+size_t corpus_raw_size(corpus_t* corpus);
+
+// Reader on file name with cache_blocks decompressed blocks, 0 if not found
+file_reader_t * corpus_reader_create(corpus_t* corpus, const char* name, size_t cache_blocks);
+
+void corpus_reader_destroy(file_reader_t* crr);
+
+
+#ifdef __cplusplus
+}
+#endif
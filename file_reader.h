@@ -2,6 +2,7 @@
 
 // General interface for file reader
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -10,12 +11,35 @@ extern "C" {
 
 
 typedef struct file_reader_s file_reader_t;
+struct reader_stats_s;  // reader_stats.h
+
+// One range of a vectored read
+typedef struct file_range_s
+{
+    size_t offset;
+    size_t length;
+    uint8_t *out;
+    size_t result;          // bytes read, set by readv
+} file_range_t;
 
 struct file_reader_s
 {
     file_reader_t *self;
     size_t (*read)(file_reader_t *self, uint8_t *out, size_t offset, size_t length);
     size_t (*size)(file_reader_t *self);
+    // Optional (may be NULL): return a pointer to data at offset without copying.
+    // *available receives the number of valid bytes (<= length, less near end of file).
+    // Pointer stays valid until the reader is destroyed.
+    const uint8_t *(*borrow)(file_reader_t *self, size_t offset, size_t length, size_t *available);
+    // Release reader, same as calling the backend specific destroy function
+    void (*destroy)(file_reader_t *self);
+    // Optional (may be NULL): copy I/O statistics collected so far
+    void (*stats)(file_reader_t *self, struct reader_stats_s *out);
+    // Optional (may be NULL): read several ranges in one call, in any order the backend likes,
+    // merging neighbouring ranges into fewer I/O calls. Sets result of every range and returns
+    // total bytes read. Current position afterwards is undefined. Call through freader_readv()
+    // which falls back to read() for backends without it.
+    size_t (*readv)(file_reader_t *self, file_range_t *ranges, size_t count);
 };
 
 
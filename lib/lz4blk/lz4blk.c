@@ -0,0 +1,175 @@
+#include <string.h>
+#include "lz4blk.h"
+
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5       // last bytes of a block are always literals
+#define MF_LIMIT        12      // last match starts at least this far from end of block
+#define MAX_DISTANCE    65535
+#define HASH_LOG        12
+
+
+static uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+
+static uint32_t hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - HASH_LOG);
+}
+
+
+// Write length continuation bytes after a 15 in the token
+static uint8_t* put_length(uint8_t* op, int len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+
+// Emit literals [anchor, anchor + lit_len) followed by a match (offset, match_len), or no
+// match when match_len is 0. Returns 0 if output does not fit
+static uint8_t* put_sequence(uint8_t* op, uint8_t* oend, const uint8_t* anchor, int lit_len, int offset, int match_len)
+{
+    uint8_t* token = op;
+    // token, literals, worst case length bytes, offset and match length bytes
+    if ((oend - op) < 1 + lit_len + lit_len / 255 + 1 + (match_len ? 2 + match_len / 255 + 1 : 0))
+        return 0;
+    ++op;
+    if (lit_len >= 15)
+    {
+        *token = 15 << 4;
+        op = put_length(op, lit_len - 15);
+    }
+    else
+        *token = (uint8_t)(lit_len << 4);
+    memcpy(op, anchor, (size_t)lit_len);
+    op += lit_len;
+    if (match_len)
+    {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        match_len -= MIN_MATCH;
+        if (match_len >= 15)
+        {
+            *token |= 15;
+            op = put_length(op, match_len - 15);
+        }
+        else
+            *token |= (uint8_t)match_len;
+    }
+    return op;
+}
+
+
+int lz4blk_compress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity)
+{
+    uint32_t table[1 << HASH_LOG];  // position + 1 of last occurrence, 0 if none
+    const uint8_t* anchor = src;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+    int ip = 0;
+
+    if ((src_size < 0) || (dst_capacity < 1))
+        return 0;
+    memset(table, 0, sizeof(table));
+
+    while (ip < src_size - MF_LIMIT)
+    {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = hash(seq);
+        int ref = (int)table[h] - 1;
+        table[h] = (uint32_t)ip + 1;
+        if ((ref >= 0) && (ip - ref <= MAX_DISTANCE) && (read32(src + ref) == seq))
+        {
+            int len = MIN_MATCH;
+            while ((ip + len < src_size - LAST_LITERALS) && (src[ref + len] == src[ip + len]))
+                ++len;
+            op = put_sequence(op, oend, anchor, (int)(src + ip - anchor), ip - ref, len);
+            if (0 == op)
+                return 0;
+            ip += len;
+            anchor = src + ip;
+            // Index a position inside the match so the next one can refer back to it
+            if (ip < src_size - MF_LIMIT)
+                table[hash(read32(src + ip - 2))] = (uint32_t)(ip - 2) + 1;
+        }
+        else
+            ++ip;
+    }
+    op = put_sequence(op, oend, anchor, (int)(src + src_size - anchor), 0, 0);
+    return op ? (int)(op - dst) : 0;
+}
+
+
+int lz4blk_decompress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_capacity;
+
+    if (src_size <= 0)
+        return -1;
+    while (1)
+    {
+        int token, len, offset, b;
+        if (ip >= iend)
+            return -1;
+        token = *ip++;
+        // literals
+        len = token >> 4;
+        if (15 == len)
+        {
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (255 == b);
+        }
+        if ((len > iend - ip) || (len > oend - op))
+            return -1;
+        memcpy(op, ip, (size_t)len);
+        op += len;
+        ip += len;
+        if (ip == iend)
+            break;      // last sequence has no match
+        // match
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((0 == offset) || (offset > op - dst))
+            return -1;
+        len = token & 15;
+        if (15 == len)
+        {
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (255 == b);
+        }
+        len += MIN_MATCH;
+        if (len > oend - op)
+            return -1;
+        // byte by byte, match may overlap its own output
+        for (int i = 0; i < len; ++i)
+            op[i] = op[i - offset];
+        op += len;
+    }
+    return (int)(op - dst);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Minimal LZ4 block format codec. Produces and accepts raw LZ4 blocks (no frame), as
+ * LZ4_compress_default() / LZ4_decompress_safe() do. Compression is a single pass greedy
+ * match finder, good for small blocks of repetitive data such as VGM command streams.
+ */
+
+// Worst case compressed size of n input bytes
+#define LZ4BLK_BOUND(n)     ((n) + (n) / 255 + 16)
+
+// Returns compressed size, 0 if output does not fit in dst_capacity
+int lz4blk_compress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity);
+
+// Returns decompressed size, -1 if input is malformed or output does not fit in dst_capacity
+int lz4blk_decompress(const uint8_t* src, int src_size, uint8_t* dst, int dst_capacity);
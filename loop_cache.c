@@ -0,0 +1,205 @@
+#include <string.h>
+#include "vgm_conf.h"
+#include "loop_cache.h"
+
+
+#define LOOP_CACHE_SKIP_BUFFER  1024
+
+
+typedef enum
+{
+    LC_OFF,         // pass through
+    LC_RECORD,      // recording first pass starting at rec_start, verifying second pass
+    LC_REPLAY       // serving from cache, decoder parked
+} lc_state_t;
+
+
+struct loop_cache_s
+{
+    vgm_t *vgm;
+    int16_t *cache;
+    unsigned long loop_start;   // first output sample inside the loop
+    unsigned long loop_len;     // period of output inside the loop, whole passes which are whole
+                                // output samples, 0 if not cacheable
+    unsigned long rec_start;    // loop start where recording begins
+    unsigned long pos;          // output position
+    unsigned long end;          // track end including all loop passes, in output samples
+    unsigned long decoded;      // decoder position, equals pos unless replaying
+    lc_state_t state;
+};
+
+
+// First loop boundary not before pos
+static unsigned long next_loop_start(loop_cache_t *lc, unsigned long pos)
+{
+    unsigned long passes;
+    if (pos <= lc->loop_start)
+        return lc->loop_start;
+    passes = (pos - lc->loop_start + lc->loop_len - 1) / lc->loop_len;
+    return lc->loop_start + passes * lc->loop_len;
+}
+
+
+// Record / verify decoded samples buffer[0..n) which are at output position pos
+static void track(loop_cache_t *lc, const int16_t *buffer, unsigned long pos, unsigned long n)
+{
+    unsigned long end = pos + n;
+    unsigned long pass2 = lc->rec_start + lc->loop_len;
+    unsigned long pass2_end = pass2 + lc->loop_len;
+    unsigned long from, to;
+
+    // Part in first pass: record
+    from = (pos > lc->rec_start) ? pos : lc->rec_start;
+    to = (end < pass2) ? end : pass2;
+    if (from < to)
+        memcpy(lc->cache + (from - lc->rec_start), buffer + (from - pos), (to - from) * sizeof(int16_t));
+    // Part in second pass: verify
+    from = (pos > pass2) ? pos : pass2;
+    to = (end < pass2_end) ? end : pass2_end;
+    if (from < to)
+    {
+        if (0 != memcmp(lc->cache + (from - pass2), buffer + (from - pos), (to - from) * sizeof(int16_t)))
+        {
+            lc->state = LC_OFF;
+            return;
+        }
+    }
+    if (end >= pass2_end)
+        lc->state = LC_REPLAY;
+}
+
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+    while (b)
+    {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+loop_cache_t * loop_cache_create(vgm_t* vgm, unsigned sample_rate, size_t max_bytes)
+{
+    loop_cache_t *lc = 0;
+    uint64_t start, len;
+    do
+    {
+        lc = (loop_cache_t *)VGM_MALLOC(sizeof(loop_cache_t));
+        if (0 == lc)
+            break;
+        memset(lc, 0, sizeof(loop_cache_t));
+        lc->vgm = vgm;
+        lc->state = LC_OFF;
+        lc->end = (unsigned long)((uint64_t)vgm->complete_samples * sample_rate / VGM_SAMPLE_RATE);
+        if ((0 == vgm->loop_samples) || (vgm->loop_samples > vgm->total_samples))
+            break;
+        // Header counts samples at 44100Hz. When a pass is not a whole number of output samples,
+        // output samples fall on another phase of the pass each time and passes differ, the
+        // phase repeats after the smallest number of passes which is. That many passes are the
+        // period recorded and verified. Recording starts at the first output sample in the loop
+        start = (uint64_t)(vgm->total_samples - vgm->loop_samples) * sample_rate;
+        len = (uint64_t)vgm->loop_samples * sample_rate;
+        len /= gcd(len, VGM_SAMPLE_RATE);
+        start = (start + VGM_SAMPLE_RATE - 1) / VGM_SAMPLE_RATE;
+        // Replay starts after two periods, too long ones are never replayed before the track ends
+        if ((len * sizeof(int16_t) > max_bytes) || (start + 2 * len >= lc->end))
+            break;
+        lc->loop_start = (unsigned long)start;
+        lc->loop_len = (unsigned long)len;
+        lc->cache = (int16_t *)VGM_MALLOC(lc->loop_len * sizeof(int16_t));
+        if (0 == lc->cache)
+        {
+            lc->loop_len = 0;
+            break;
+        }
+        lc->rec_start = lc->loop_start;
+        lc->state = LC_RECORD;
+    } while (0);
+    return lc;
+}
+
+
+void loop_cache_destroy(loop_cache_t* lc)
+{
+    if (lc)
+    {
+        if (lc->cache)
+            VGM_FREE(lc->cache);
+        VGM_FREE(lc);
+    }
+}
+
+
+int loop_cache_get_samples(loop_cache_t* lc, int16_t* buffer, unsigned int samples)
+{
+    int n;
+    if (LC_REPLAY == lc->state)
+    {
+        unsigned long offset = (lc->pos - lc->loop_start) % lc->loop_len;
+        unsigned int done = 0;
+        if (lc->pos >= lc->end)
+            return 0;
+        if (samples > lc->end - lc->pos)
+            samples = (unsigned int)(lc->end - lc->pos);
+        while (done < samples)
+        {
+            unsigned long chunk = lc->loop_len - offset;
+            if (chunk > samples - done)
+                chunk = samples - done;
+            memcpy(buffer + done, lc->cache + offset, chunk * sizeof(int16_t));
+            done += (unsigned int)chunk;
+            offset = 0;
+        }
+        lc->pos += samples;
+        return (int)samples;
+    }
+    n = vgm_get_samples(lc->vgm, buffer, samples);
+    if (n > 0)
+    {
+        if (LC_RECORD == lc->state)
+            track(lc, buffer, lc->pos, (unsigned long)n);
+        lc->pos += (unsigned long)n;
+        lc->decoded = lc->pos;
+    }
+    return n;
+}
+
+
+void loop_cache_invalidate(loop_cache_t* lc)
+{
+    if (0 == lc->loop_len)
+        return;
+    if (LC_REPLAY == lc->state)
+    {
+        // Parked decoder is a whole number of loops behind plus the part of current pass
+        int16_t buffer[LOOP_CACHE_SKIP_BUFFER];
+        unsigned long skip = (lc->pos - lc->decoded) % lc->loop_len;
+        while (skip > 0)
+        {
+            int n = vgm_get_samples(lc->vgm, buffer, (skip > LOOP_CACHE_SKIP_BUFFER) ? LOOP_CACHE_SKIP_BUFFER : (unsigned int)skip);
+            if (n <= 0)
+                break;
+            skip -= (unsigned long)n;
+        }
+        lc->decoded = lc->pos;
+    }
+    lc->rec_start = next_loop_start(lc, lc->pos);
+    lc->state = LC_RECORD;
+}
+
+
+void loop_cache_seek(loop_cache_t* lc, vgm_t* vgm, unsigned long pos)
+{
+    lc->vgm = vgm;
+    lc->pos = pos;
+    lc->decoded = pos;
+    if (0 == lc->loop_len)
+        return;
+    if ((LC_REPLAY == lc->state) && (pos >= lc->loop_start))
+        return;
+    lc->rec_start = next_loop_start(lc, pos);
+    lc->state = LC_RECORD;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "vgm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Loop body PCM cache for looped playback. Stands between player and vgm_get_samples().
+// First loop pass is recorded, second pass is compared against it. When both are identical
+// the decoder is parked and later passes are served from the recording. When a pass is not a
+// whole number of output samples (e.g. 48000Hz output), the smallest number of passes which is
+// takes the place of a pass. If passes differ, they do not fit max_bytes or the track ends
+// before two of them are decoded, samples are passed through from the decoder unchanged.
+// Replay ends with the track, after the loop passes counted in vgm->complete_samples, like the
+// decoder would.
+
+typedef struct loop_cache_s loop_cache_t;
+
+// vgm must be prepared with vgm_prepare_playback(vgm, sample_rate, true)
+loop_cache_t * loop_cache_create(vgm_t* vgm, unsigned sample_rate, size_t max_bytes);
+
+void loop_cache_destroy(loop_cache_t* lc);
+
+// Same contract as vgm_get_samples()
+int loop_cache_get_samples(loop_cache_t* lc, int16_t* buffer, unsigned int samples);
+
+// Decoder output changed (e.g. channel enabled/disabled): drop recording, bring decoder to
+// current position and record again from next loop start
+void loop_cache_invalidate(loop_cache_t* lc);
+
+// Playback continues at output position pos from vgm, which is prepared like the one given to
+// loop_cache_create() and already decoded up to pos. A recording stays in use if pos is inside
+// the loop, otherwise recording starts again from next loop start
+void loop_cache_seek(loop_cache_t* lc, vgm_t* vgm, unsigned long pos);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "vgm_conf.h"
+#include "loop_cache.h"
+
+
+// Checks loop_cache output against the plain decoder. loop_cache only calls vgm_get_samples() of
+// vgmcore, it is stood in for here by a decoder whose output depends on position alone, so the
+// run count of every pass is under control of the test
+
+#define INTRO       1000
+#define LOOP        3000
+#define PASSES      5       // loop passes in complete track, >= 2 are replayed from cache
+#define CHUNK       777     // not a divisor of anything above, chunks straddle loop boundaries
+#define BUDGET      (1 << 20)
+
+// At 48000Hz a pass of 2100 samples is 2285.71 output samples, 7 passes are 16000. Intro is
+// 1088.43 output samples
+#define RATE_48K    48000
+#define LOOP_48K    2100
+#define PASSES_48K  20
+
+
+typedef struct
+{
+    vgm_t vgm;
+    unsigned rate;          // output rate, samples are held from the 44100Hz stream
+    unsigned long pos;
+    unsigned long diverge;  // position in second pass that differs from first pass, 0 for none
+    int16_t mask;           // changes output like toggling a channel
+} stand_in_t;
+
+
+static unsigned long decoded;   // samples produced by all stand-in decoders
+
+
+int vgm_get_samples(vgm_t *vgm, int16_t *buffer, unsigned int samples)
+{
+    stand_in_t *d = (stand_in_t *)vgm;
+    unsigned long loop_start = vgm->total_samples - vgm->loop_samples;
+    unsigned long end = (unsigned long)((uint64_t)vgm->complete_samples * d->rate / VGM_SAMPLE_RATE);
+    unsigned int n = 0;
+    for (; (n < samples) && (d->pos < end); ++n, ++d->pos)
+    {
+        unsigned long i = (unsigned long)((uint64_t)d->pos * VGM_SAMPLE_RATE / d->rate);
+        if (i >= loop_start)
+            i = loop_start + (i - loop_start) % vgm->loop_samples;
+        buffer[n] = (int16_t)(((uint32_t)i * 2654435761u) >> 16);
+        if (d->pos == d->diverge)
+            buffer[n] ^= 1;
+        buffer[n] ^= d->mask;
+    }
+    decoded += n;
+    return (int)n;
+}
+
+
+static void stand_in_init(stand_in_t *d, unsigned rate, unsigned long loop, unsigned long passes, unsigned long diverge)
+{
+    memset(d, 0, sizeof(stand_in_t));
+    d->vgm.total_samples = INTRO + loop;
+    d->vgm.loop_samples = loop;
+    d->vgm.complete_samples = INTRO + passes * loop;
+    d->rate = rate;
+    d->diverge = diverge;
+}
+
+
+// Play whole track through cache and directly, toggle the mask of both at toggle_at if not 0.
+// Returns samples the cached run took from its decoder, or -1 on mismatch
+static long compare_rate_run(unsigned rate, unsigned long loop, unsigned long passes, unsigned long diverge, unsigned long toggle_at)
+{
+    static int16_t cached[CHUNK], direct[CHUNK];
+    stand_in_t a, b;
+    loop_cache_t *lc;
+    unsigned long pos = 0;
+    int n, m;
+    long r = -1;
+
+    stand_in_init(&a, rate, loop, passes, diverge);
+    stand_in_init(&b, rate, loop, passes, diverge);
+    lc = loop_cache_create(&a.vgm, rate, BUDGET);
+    if (0 == lc)
+        return -1;
+    decoded = 0;
+    do
+    {
+        if ((0 != toggle_at) && (pos == toggle_at))
+        {
+            a.mask = b.mask = 0x100;
+            loop_cache_invalidate(lc);
+        }
+        n = loop_cache_get_samples(lc, cached, CHUNK);
+        m = vgm_get_samples(&b.vgm, direct, CHUNK);
+        if ((n != m) || (0 != memcmp(cached, direct, (size_t)(n > 0 ? n : 0) * sizeof(int16_t))))
+            break;
+        pos += (unsigned long)n;
+    } while (n > 0);
+    if ((0 == n) && (pos == (unsigned long)((uint64_t)(INTRO + passes * loop) * rate / VGM_SAMPLE_RATE)))
+        r = (long)(decoded - pos);  // what b decoded is pos
+    loop_cache_destroy(lc);
+    return r;
+}
+
+
+static long compare_run(unsigned long diverge, unsigned long toggle_at)
+{
+    return compare_rate_run(VGM_SAMPLE_RATE, LOOP, PASSES, diverge, toggle_at);
+}
+
+
+static bool check(const char *name, bool ok)
+{
+    VGM_PRINTF("%s: %s\n", name, ok ? "ok" : "failed");
+    return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+    long used;
+
+    // Record, verify, then serve the remaining passes from memory and stop at track end
+    used = compare_run(0, 0);
+    ok &= check("replay matches decoder", used >= 0);
+    ok &= check("decoder parked for passes 3..5", (used >= 0) && (used < INTRO + 3 * LOOP));
+
+    // Second pass differs, all of the track must come from the decoder
+    used = compare_run(INTRO + LOOP + 1234, 0);
+    ok &= check("differing passes pass through", used == INTRO + PASSES * LOOP);
+
+    // Output changes while replaying: decoder catches up mid-pass and is recorded again
+    used = compare_run(0, 13 * CHUNK);
+    ok &= check("invalidate while replaying", used >= 0);
+
+    // Passes are not whole output samples, 7 of them are recorded and verified as one period
+    used = compare_rate_run(RATE_48K, LOOP_48K, PASSES_48K, 0, 0);
+    ok &= check("replay at 48000Hz matches decoder", used >= 0);
+    ok &= check("decoder parked after two periods at 48000Hz", (used >= 0) && (used < 1089 + 2 * 16000 + CHUNK));
+
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+#include "vgm_conf.h"
+#include "mapped_file_reader.h"
+#include "reader_stats.h"
+
+
+// Read ahead asked for at open. A pack maps a whole library, the rest is paged in on demand
+#define MFR_WILLNEED_WINDOW (256 * 1024)
+
+
+// Mapped File Reader
+typedef struct mfr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    const uint8_t* base;
+    size_t length;
+    size_t pos;
+    reader_stats_t stats;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} mfr_t;
+
+
+static const uint8_t * mfr_borrow(file_reader_t *self, size_t offset, size_t length, size_t *available)
+{
+    mfr_t *ctx = (mfr_t *)self;
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    *available = (offset < ctx->length) ? ctx->length - offset : 0;
+    if (*available > length)
+        *available = length;
+    reader_stats_count_read(&ctx->stats, offset, length, *available);
+    ctx->stats.cache_hit += *available;
+    if (0 == *available)
+        return 0;
+    ctx->pos = offset + *available;
+    return ctx->base + offset;
+}
+
+
+static size_t mfr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    size_t available;
+    const uint8_t *p = mfr_borrow(self, offset, length, &available);
+    if (available > 0)
+    {
+        memcpy(out, p, available);
+        ((mfr_t *)self)->stats.bytes_copied += available;
+    }
+    return available;
+}
+
+
+static size_t mfr_size(file_reader_t *self)
+{
+    mfr_t *ctx = (mfr_t *)self;
+    return ctx ? ctx->length : 0;
+}
+
+
+static void mfr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((mfr_t *)self)->stats;
+}
+
+
+#ifdef _WIN32
+
+static int map_file(mfr_t *ctx, const char *fn)
+{
+    LARGE_INTEGER len;
+    ctx->file = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == ctx->file)
+        return -1;
+    if (!GetFileSizeEx(ctx->file, &len))
+        return -1;
+    ctx->length = (size_t)len.QuadPart;
+    if (0 == ctx->length)
+        return 0;   // empty file can not be mapped, leave base as NULL
+    ctx->mapping = CreateFileMappingA(ctx->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == ctx->mapping)
+        return -1;
+    ctx->base = (const uint8_t *)MapViewOfFile(ctx->mapping, FILE_MAP_READ, 0, 0, 0);
+    return (NULL == ctx->base) ? -1 : 0;
+}
+
+
+static void unmap_file(mfr_t *ctx)
+{
+    if (ctx->base)
+        UnmapViewOfFile(ctx->base);
+    if (ctx->mapping)
+        CloseHandle(ctx->mapping);
+    if (INVALID_HANDLE_VALUE != ctx->file)
+        CloseHandle(ctx->file);
+}
+
+#else
+
+static int map_file(mfr_t *ctx, const char *fn)
+{
+    struct stat st;
+    void *p;
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    ctx->length = (size_t)st.st_size;
+    if (0 == ctx->length)
+    {
+        close(fd);
+        return 0;   // empty file can not be mapped, leave base as NULL
+    }
+    p = mmap(NULL, ctx->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);      // mapping keeps its own reference to the file
+    if (MAP_FAILED == p)
+        return -1;
+    // Header and first commands are read right away, let kernel fetch them in one go
+    madvise(p, (ctx->length < MFR_WILLNEED_WINDOW) ? ctx->length : MFR_WILLNEED_WINDOW, MADV_WILLNEED);
+    ctx->base = (const uint8_t *)p;
+    return 0;
+}
+
+
+static void unmap_file(mfr_t *ctx)
+{
+    if (ctx->base)
+        munmap((void *)ctx->base, ctx->length);
+}
+
+#endif
+
+
+file_reader_t * mfreader_create(const char* fn)
+{
+    mfr_t *ctx = (mfr_t*)VGM_MALLOC(sizeof(mfr_t));
+    if (0 == ctx)
+        return 0;
+
+    ctx->base = 0;
+    ctx->length = 0;
+    ctx->pos = 0;
+    reader_stats_reset(&ctx->stats);
+#ifdef _WIN32
+    ctx->file = INVALID_HANDLE_VALUE;
+    ctx->mapping = NULL;
+#endif
+
+    if (map_file(ctx, fn) != 0)
+    {
+        unmap_file(ctx);
+        VGM_FREE(ctx);
+        return 0;
+    }
+
+    ctx->super.self = (file_reader_t*)ctx;
+    ctx->super.read = mfr_read;
+    ctx->super.size = mfr_size;
+    ctx->super.borrow = mfr_borrow;
+    ctx->super.destroy = mfreader_destroy;
+    ctx->super.stats = mfr_stats;
+    ctx->super.readv = 0;
+
+    return (file_reader_t*)ctx;
+}
+
+
+void mfreader_destroy(file_reader_t *mfr)
+{
+    mfr_t* ctx = (mfr_t*)mfr;
+    if (0 == ctx)
+        return;
+    unmap_file(ctx);
+    VGM_FREE(ctx);
+}
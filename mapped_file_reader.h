@@ -0,0 +1,20 @@
+#pragma once
+
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Memory mapped file reader. Whole file is mapped read-only, read() copies straight
+// out of the mapping and borrow() hands out pointers into it.
+
+file_reader_t * mfreader_create(const char* fn);
+
+void mfreader_destroy(file_reader_t* mfr);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "vgm_conf.h"
+#include "memory_file_reader.h"
+#include "reader_stats.h"
+
+
+// Memory File Reader
+typedef struct memr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    const uint8_t* data;
+    size_t length;
+    size_t pos;
+    reader_stats_t stats;
+    bool owned;
+} memr_t;
+
+
+static const uint8_t * memr_borrow(file_reader_t *self, size_t offset, size_t length, size_t *available)
+{
+    memr_t *ctx = (memr_t *)self;
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    *available = (offset < ctx->length) ? ctx->length - offset : 0;
+    if (*available > length)
+        *available = length;
+    reader_stats_count_read(&ctx->stats, offset, length, *available);
+    ctx->stats.cache_hit += *available;
+    if (0 == *available)
+        return 0;
+    ctx->pos = offset + *available;
+    return ctx->data + offset;
+}
+
+
+static size_t memr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    size_t available;
+    const uint8_t *p = memr_borrow(self, offset, length, &available);
+    if (available > 0)
+    {
+        memcpy(out, p, available);
+        ((memr_t *)self)->stats.bytes_copied += available;
+    }
+    return available;
+}
+
+
+static size_t memr_size(file_reader_t *self)
+{
+    memr_t *ctx = (memr_t *)self;
+    return ctx ? ctx->length : 0;
+}
+
+
+static void memr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((memr_t *)self)->stats;
+}
+
+
+file_reader_t * memreader_create_from_buffer(const uint8_t* data, size_t length, bool owned)
+{
+    memr_t *ctx = (memr_t*)VGM_MALLOC(sizeof(memr_t));
+    if (0 == ctx)
+        return 0;
+
+    ctx->data = data;
+    ctx->length = length;
+    ctx->pos = 0;
+    reader_stats_reset(&ctx->stats);
+    ctx->owned = owned;
+
+    ctx->super.self = (file_reader_t*)ctx;
+    ctx->super.read = memr_read;
+    ctx->super.size = memr_size;
+    ctx->super.borrow = memr_borrow;
+    ctx->super.destroy = memreader_destroy;
+    ctx->super.stats = memr_stats;
+    ctx->super.readv = 0;
+
+    return (file_reader_t*)ctx;
+}
+
+
+file_reader_t * memreader_create(const char* fn)
+{
+    FILE *fd = 0;
+    uint8_t *data = 0;
+    file_reader_t *reader = 0;
+    struct stat st;
+    size_t length;
+    uint64_t t;
+
+    do
+    {
+        fd = fopen(fn, "rb");
+        if (0 == fd)
+            break;
+        if (fstat(fileno(fd), &st) != 0)
+            break;
+        length = (size_t)st.st_size;
+        // One extra byte so an empty file still gets a valid allocation
+        data = (uint8_t*)VGM_MALLOC(length + 1);
+        if (0 == data)
+            break;
+        // No stdio buffering, file goes straight into our buffer in one read
+        setvbuf(fd, NULL, _IONBF, 0);
+        t = reader_stats_clock();
+        if (fread(data, 1, length, fd) != length)
+            break;
+        t = reader_stats_clock() - t;
+        reader = memreader_create_from_buffer(data, length, true);
+        if (reader)
+        {
+            ((memr_t *)reader)->stats.io_reads = 1;
+            ((memr_t *)reader)->stats.io_ns = t;
+        }
+    } while (0);
+
+    if ((0 == reader) && data)
+        VGM_FREE(data);
+    if (fd)
+        fclose(fd);
+    return reader;
+}
+
+
+void memreader_destroy(file_reader_t *mem)
+{
+    memr_t* ctx = (memr_t*)mem;
+    if (0 == ctx)
+        return;
+    if (ctx->owned && ctx->data)
+        VGM_FREE((void *)ctx->data);
+    VGM_FREE(ctx);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// In-memory file reader. Whole file is loaded with a single read at creation.
+
+file_reader_t * memreader_create(const char* fn);
+
+// Serve reads from caller supplied buffer. If owned, buffer is released with VGM_FREE on destroy
+file_reader_t * memreader_create_from_buffer(const uint8_t* data, size_t length, bool owned);
+
+void memreader_destroy(file_reader_t* mem);
+
+
+#ifdef __cplusplus
+}
+#endif
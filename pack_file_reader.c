@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_conf.h"
+#include "pack_file_reader.h"
+#include "mapped_file_reader.h"
+#include "memory_file_reader.h"
+#include "reader_stats.h"
+
+
+typedef struct vpack_entry_s
+{
+    char* name;
+    uint32_t hash;
+    size_t offset;
+    size_t size;
+} vpack_entry_t;
+
+
+struct vpack_s
+{
+    file_reader_t* file;        // whole pack, mapped (or preloaded if mapping fails)
+    const uint8_t* base;
+    size_t length;
+    vpack_entry_t* entries;
+    unsigned count;
+    unsigned* table;            // open addressing hash table of entry index + 1, 0 = empty
+    unsigned table_mask;
+};
+
+
+// Pack Member Reader
+typedef struct vpr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    const uint8_t* data;
+    size_t length;
+    size_t pos;
+    reader_stats_t stats;
+} vpr_t;
+
+
+static uint32_t fnv1a(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+
+static const uint8_t * vpr_borrow(file_reader_t *self, size_t offset, size_t length, size_t *available)
+{
+    vpr_t *ctx = (vpr_t *)self;
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    *available = (offset < ctx->length) ? ctx->length - offset : 0;
+    if (*available > length)
+        *available = length;
+    reader_stats_count_read(&ctx->stats, offset, length, *available);
+    ctx->stats.cache_hit += *available;
+    if (0 == *available)
+        return 0;
+    ctx->pos = offset + *available;
+    return ctx->data + offset;
+}
+
+
+static size_t vpr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    size_t available;
+    const uint8_t *p = vpr_borrow(self, offset, length, &available);
+    if (available > 0)
+    {
+        memcpy(out, p, available);
+        ((vpr_t *)self)->stats.bytes_copied += available;
+    }
+    return available;
+}
+
+
+static size_t vpr_size(file_reader_t *self)
+{
+    vpr_t *ctx = (vpr_t *)self;
+    return ctx ? ctx->length : 0;
+}
+
+
+static void vpr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((vpr_t *)self)->stats;
+}
+
+
+static bool parse_index(vpack_t *pack)
+{
+    const uint8_t *p = pack->base;
+    const uint8_t *end;
+    size_t index_size, name_len, slot;
+    unsigned table_size = 1;
+
+    if ((pack->length < VPACK_HEADER_SIZE) || memcmp(p, VPACK_MAGIC, 4) || (get_u32(p + 4) != VPACK_VERSION))
+        return false;
+    pack->count = get_u32(p + 8);
+    index_size = get_u32(p + 12);
+    if (index_size > pack->length - VPACK_HEADER_SIZE)
+        return false;
+    // Every entry takes at least VPACK_ENTRY_SIZE bytes of index, bound count before allocating
+    if (pack->count > index_size / VPACK_ENTRY_SIZE)
+        return false;
+    p += VPACK_HEADER_SIZE;
+    end = p + index_size;
+
+    pack->entries = (vpack_entry_t*)VGM_MALLOC(sizeof(vpack_entry_t) * (pack->count ? pack->count : 1));
+    if (0 == pack->entries)
+        return false;
+    memset(pack->entries, 0, sizeof(vpack_entry_t) * (pack->count ? pack->count : 1));
+    while (table_size < pack->count * 2)
+        table_size <<= 1;
+    pack->table = (unsigned*)VGM_MALLOC(sizeof(unsigned) * table_size);
+    if (0 == pack->table)
+        return false;
+    memset(pack->table, 0, sizeof(unsigned) * table_size);
+    pack->table_mask = table_size - 1;
+
+    for (unsigned i = 0; i < pack->count; ++i)
+    {
+        vpack_entry_t *e = pack->entries + i;
+        if (end - p < VPACK_ENTRY_SIZE)
+            return false;
+        e->offset = (size_t)get_u64(p);
+        e->size = (size_t)get_u64(p + 8);
+        name_len = (size_t)p[16] | ((size_t)p[17] << 8);
+        p += VPACK_ENTRY_SIZE;
+        if (((size_t)(end - p) < name_len) || (e->offset > pack->length) || (e->size > pack->length - e->offset))
+            return false;
+        e->name = (char*)VGM_MALLOC(name_len + 1);
+        if (0 == e->name)
+            return false;
+        memcpy(e->name, p, name_len);
+        e->name[name_len] = '\0';
+        e->hash = fnv1a(e->name, name_len);
+        p += name_len;
+        slot = e->hash & pack->table_mask;
+        while (pack->table[slot])
+            slot = (slot + 1) & pack->table_mask;
+        pack->table[slot] = i + 1;
+    }
+    return true;
+}
+
+
+vpack_t * vpack_open(const char* fn)
+{
+    vpack_t *pack = (vpack_t*)VGM_MALLOC(sizeof(vpack_t));
+    size_t available;
+    if (0 == pack)
+        return 0;
+    memset(pack, 0, sizeof(vpack_t));
+
+    pack->file = mfreader_create(fn);
+    if (0 == pack->file)
+        pack->file = memreader_create(fn);
+    if (pack->file)
+    {
+        // Both backends lend the whole file, valid until the reader is destroyed
+        pack->length = pack->file->size(pack->file);
+        pack->base = pack->file->borrow(pack->file, 0, pack->length, &available);
+        if (pack->base && (available == pack->length) && parse_index(pack))
+            return pack;
+    }
+    vpack_close(pack);
+    return 0;
+}
+
+
+void vpack_close(vpack_t* pack)
+{
+    if (0 == pack)
+        return;
+    if (pack->entries)
+    {
+        for (unsigned i = 0; i < pack->count; ++i)
+        {
+            if (pack->entries[i].name)
+                VGM_FREE(pack->entries[i].name);
+        }
+        VGM_FREE(pack->entries);
+    }
+    if (pack->table)
+        VGM_FREE(pack->table);
+    if (pack->file)
+        pack->file->destroy(pack->file);
+    VGM_FREE(pack);
+}
+
+
+unsigned vpack_count(vpack_t* pack)
+{
+    return pack ? pack->count : 0;
+}
+
+
+const char * vpack_name(vpack_t* pack, unsigned index)
+{
+    return (pack && (index < pack->count)) ? pack->entries[index].name : 0;
+}
+
+
+file_reader_t * vpack_reader_create(vpack_t* pack, const char* name)
+{
+    vpack_entry_t *e = 0;
+    vpr_t *ctx;
+    uint32_t hash;
+    size_t slot;
+
+    if ((0 == pack) || (0 == name))
+        return 0;
+    hash = fnv1a(name, strlen(name));
+    for (slot = hash & pack->table_mask; pack->table[slot]; slot = (slot + 1) & pack->table_mask)
+    {
+        e = pack->entries + pack->table[slot] - 1;
+        if ((e->hash == hash) && (0 == strcmp(e->name, name)))
+            break;
+        e = 0;
+    }
+    if (0 == e)
+        return 0;
+
+    ctx = (vpr_t*)VGM_MALLOC(sizeof(vpr_t));
+    if (0 == ctx)
+        return 0;
+
+    ctx->data = pack->base + e->offset;
+    ctx->length = e->size;
+    ctx->pos = 0;
+    reader_stats_reset(&ctx->stats);
+
+    ctx->super.self = (file_reader_t*)ctx;
+    ctx->super.read = vpr_read;
+    ctx->super.size = vpr_size;
+    ctx->super.borrow = vpr_borrow;
+    ctx->super.destroy = vpack_reader_destroy;
+    ctx->super.stats = vpr_stats;
+    ctx->super.readv = 0;
+
+    return (file_reader_t*)ctx;
+}
+
+
+void vpack_reader_destroy(file_reader_t *vpr)
+{
+    if (vpr)
+        VGM_FREE(vpr);
+}
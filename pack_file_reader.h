@@ -0,0 +1,46 @@
+#pragma once
+
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Pack file reader. A pack is a single container file holding many VGM files. The pack is
+// mapped once, each member is opened by name with a hash lookup and read as a sub-range of
+// the shared mapping, no filesystem calls are made per member.
+//
+// Pack format, all fields little endian:
+//   header:  "VPAK", uint32 version, uint32 member count, uint32 index size in bytes
+//   index:   per member: uint64 offset, uint64 size, uint16 name length, name (no terminator)
+//   data:    member contents, each starting at a multiple of VPACK_ALIGN
+
+#define VPACK_MAGIC         "VPAK"
+#define VPACK_VERSION       1
+#define VPACK_HEADER_SIZE   16
+#define VPACK_ENTRY_SIZE    18      // excluding name
+#define VPACK_ALIGN         16
+
+typedef struct vpack_s vpack_t;
+
+vpack_t * vpack_open(const char* fn);
+
+// All member readers must be destroyed before closing the pack
+void vpack_close(vpack_t* pack);
+
+unsigned vpack_count(vpack_t* pack);
+
+// Name of member index, for listing
+const char * vpack_name(vpack_t* pack, unsigned index);
+
+// Open member by name, returns 0 if not found. Readers are independent and may be used
+// from different threads
+file_reader_t * vpack_reader_create(vpack_t* pack, const char* name);
+
+void vpack_reader_destroy(file_reader_t* vpr);
+
+
+#ifdef __cplusplus
+}
+#endif
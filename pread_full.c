@@ -0,0 +1,40 @@
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+#include "pread_full.h"
+
+
+size_t pread_full(pread_file_t file, uint8_t* out, size_t offset, size_t length, size_t file_size, reader_stats_t* stats)
+{
+    size_t total = 0;
+    uint64_t t;
+    if (offset >= file_size)
+        return 0;
+    if (length > file_size - offset)
+        length = file_size - offset;
+    t = reader_stats_clock();
+    while (total < length)
+    {
+        ++stats->io_reads;
+#ifdef _WIN32
+        OVERLAPPED ov;
+        DWORD got = 0;
+        DWORD want = (length - total > 0x40000000) ? 0x40000000 : (DWORD)(length - total);
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)((uint64_t)(offset + total) & 0xffffffff);
+        ov.OffsetHigh = (DWORD)((uint64_t)(offset + total) >> 32);
+        if (!ReadFile((HANDLE)file, out + total, want, &got, &ov) || (0 == got))
+            break;
+#else
+        ssize_t got = pread(file, out + total, length - total, (off_t)(offset + total));
+        if (got <= 0)
+            break;
+#endif
+        total += (size_t)got;
+    }
+    stats->io_ns += reader_stats_clock() - t;
+    return total;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "reader_stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Native file handle for positional reads, HANDLE on Windows
+#ifdef _WIN32
+typedef void* pread_file_t;
+#else
+typedef int pread_file_t;
+#endif
+
+
+// Positional read, no file offset to seek or query. Retries short reads until length or end of
+// file, nothing is read past file_size. Counts the calls and time spent in stats.
+size_t pread_full(pread_file_t file, uint8_t* out, size_t offset, size_t length, size_t file_size, reader_stats_t* stats);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_conf.h"
+#include "vgm_thread.h"
+#include "prefetch_file_reader.h"
+#include "reader_stats.h"
+
+
+// Consecutive sequential reads before worker starts prefetching
+#define PFR_SEQUENTIAL_THRESHOLD    2
+
+// Buffers in the ring, up to PFR_BLOCKS - 1 blocks are read ahead of the one being consumed
+#define PFR_BLOCKS      4
+
+// Buffer states. Caller owns EMPTY and READY buffers, worker owns LOADING buffers,
+// QUEUED buffers may be taken back by the caller. Changes are made under lock.
+#define PFR_EMPTY       0
+#define PFR_READY       1
+#define PFR_QUEUED      2
+#define PFR_LOADING     3
+
+
+typedef struct pfr_buffer_s
+{
+    size_t offset;          // file offset of data[0]
+    size_t length;          // valid bytes when READY
+    int state;
+    uint8_t* data;
+} pfr_buffer_t;
+
+
+// Prefetch File Reader
+typedef struct pfr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    FILE* fd;               // caller thread, synchronous misses only
+    FILE* bg_fd;            // worker thread
+    size_t file_size;
+    size_t block_size;
+    size_t pos;             // end of last read, for sequential detection
+    unsigned sequential;    // count of consecutive sequential reads
+    pfr_buffer_t buf[PFR_BLOCKS];
+    int current;            // buffer of last read, -1 if none
+    // Worker
+    vthread_t thread;
+    vmutex_t lock;
+    vcond_t cond;
+    bool quit;
+    reader_stats_t stats;   // caller thread
+    reader_stats_t bg_stats;// worker thread, I/O counters only, protected by lock
+} pfr_t;
+
+
+static size_t read_file(FILE* fd, uint8_t *out, size_t offset, size_t length, reader_stats_t *st)
+{
+    size_t r = 0;
+    uint64_t t = reader_stats_clock();
+    ++st->io_seeks;
+    if (0 == fseek(fd, (long)offset, SEEK_SET))
+    {
+        ++st->io_reads;
+        r = fread(out, 1, length, fd);
+    }
+    st->io_ns += reader_stats_clock() - t;
+    return r;
+}
+
+
+// Queued buffer with lowest offset, -1 if none. Called with lock held.
+static int next_queued(pfr_t *ctx)
+{
+    int r = -1;
+    for (int i = 0; i < PFR_BLOCKS; ++i)
+    {
+        if ((PFR_QUEUED == ctx->buf[i].state) && ((r < 0) || (ctx->buf[i].offset < ctx->buf[r].offset)))
+            r = i;
+    }
+    return r;
+}
+
+
+VTHREAD_FUNC(pfr_worker, arg)
+{
+    pfr_t *ctx = (pfr_t *)arg;
+    pfr_buffer_t *b;
+    reader_stats_t io;
+    size_t length;
+    int i = -1;
+
+    vmutex_lock(&ctx->lock);
+    while (1)
+    {
+        while (!ctx->quit && ((i = next_queued(ctx)) < 0))
+            vcond_wait(&ctx->cond, &ctx->lock);
+        if (ctx->quit)
+            break;
+        b = &(ctx->buf[i]);
+        b->state = PFR_LOADING;
+        vmutex_unlock(&ctx->lock);
+        // Buffer belongs to worker until it is marked ready
+        reader_stats_reset(&io);
+        length = read_file(ctx->bg_fd, b->data, b->offset, ctx->block_size, &io);
+        vmutex_lock(&ctx->lock);
+        ctx->bg_stats.io_seeks += io.io_seeks;
+        ctx->bg_stats.io_reads += io.io_reads;
+        ctx->bg_stats.io_ns += io.io_ns;
+        b->length = length;
+        b->state = PFR_READY;
+    }
+    vmutex_unlock(&ctx->lock);
+    VTHREAD_RETURN;
+}
+
+
+static bool in_buffer(pfr_buffer_t *b, size_t offset)
+{
+    return (PFR_READY == b->state) && (offset >= b->offset) && (offset < b->offset + b->length);
+}
+
+
+// Ready buffer holding offset, -1 if none
+static int lookup(pfr_t *ctx, size_t offset)
+{
+    int r = -1;
+    if ((ctx->current >= 0) && in_buffer(&(ctx->buf[ctx->current]), offset))
+        return ctx->current;
+    vmutex_lock(&ctx->lock);
+    for (int i = 0; i < PFR_BLOCKS; ++i)
+    {
+        if (in_buffer(&(ctx->buf[i]), offset))
+        {
+            r = i;
+            break;
+        }
+    }
+    vmutex_unlock(&ctx->lock);
+    return r;
+}
+
+
+// Take a buffer for a synchronous load at offset. The caller never waits for the worker:
+// a block still queued is taken back, a block being loaded is read again by the caller.
+// There is always a free one as prefetch never queues the current buffer.
+static int take_buffer(pfr_t *ctx, size_t offset)
+{
+    int r = -1;
+    vmutex_lock(&ctx->lock);
+    for (int i = 0; i < PFR_BLOCKS; ++i)
+    {
+        pfr_buffer_t *b = &(ctx->buf[i]);
+        if ((PFR_QUEUED == b->state) && (offset >= b->offset) && (offset < b->offset + ctx->block_size))
+        {
+            r = i;
+            break;
+        }
+        if ((PFR_EMPTY == b->state) && ((r < 0) || (PFR_EMPTY != ctx->buf[r].state)))
+            r = i;
+        else if ((PFR_READY == b->state) && ((r < 0) || ((PFR_READY == ctx->buf[r].state) && (b->offset < ctx->buf[r].offset))))
+            r = i;
+    }
+    if (r >= 0)
+        ctx->buf[r].state = PFR_READY;
+    vmutex_unlock(&ctx->lock);
+    return r;
+}
+
+
+// Non-empty buffer starting at offset, -1 if none. Called with lock held.
+static int find_block(pfr_t *ctx, size_t offset)
+{
+    for (int i = 0; i < PFR_BLOCKS; ++i)
+    {
+        if ((PFR_EMPTY != ctx->buf[i].state) && (ctx->buf[i].offset == offset))
+            return i;
+    }
+    return -1;
+}
+
+
+// Keep the blocks following the current buffer loaded or queued for the worker
+static void prefetch(pfr_t *ctx)
+{
+    bool keep[PFR_BLOCKS];
+    pfr_buffer_t *cur = &(ctx->buf[ctx->current]);
+    size_t next = cur->offset + cur->length;
+    bool queued = false;
+    int i, j;
+
+    if ((cur->length < ctx->block_size) || (next >= ctx->file_size))
+        return;
+    memset(keep, 0, sizeof(keep));
+    keep[ctx->current] = true;
+    vmutex_lock(&ctx->lock);
+    // Queued loads from an earlier position are stale
+    for (i = 0; i < PFR_BLOCKS; ++i)
+    {
+        if (PFR_QUEUED == ctx->buf[i].state)
+            ctx->buf[i].state = PFR_EMPTY;
+    }
+    // First pass marks blocks already loaded or loading, so second pass does not recycle them
+    for (j = 1; (j < PFR_BLOCKS) && (next < ctx->file_size); ++j, next += ctx->block_size)
+    {
+        i = find_block(ctx, next);
+        if (i >= 0)
+            keep[i] = true;
+    }
+    next = cur->offset + cur->length;
+    for (j = 1; (j < PFR_BLOCKS) && (next < ctx->file_size); ++j, next += ctx->block_size)
+    {
+        if (find_block(ctx, next) >= 0)
+            continue;
+        for (i = 0; i < PFR_BLOCKS; ++i)
+        {
+            if (!keep[i] && ((PFR_EMPTY == ctx->buf[i].state) || (PFR_READY == ctx->buf[i].state)))
+                break;
+        }
+        if (PFR_BLOCKS == i)
+            break;
+        keep[i] = true;
+        ctx->buf[i].offset = next;
+        ctx->buf[i].length = 0;
+        ctx->buf[i].state = PFR_QUEUED;
+        queued = true;
+    }
+    if (queued)
+        vcond_broadcast(&ctx->cond);
+    vmutex_unlock(&ctx->lock);
+}
+
+
+static size_t pfr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    pfr_t *ctx = (pfr_t *)self;
+    pfr_buffer_t *b;
+    size_t total = 0, temp, start, requested = length;
+    bool loaded;
+    int i;
+
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    start = offset;
+
+    if (offset == ctx->pos)
+        ++ctx->sequential;
+    else
+        ctx->sequential = 0;
+
+    while (length > 0)
+    {
+        loaded = false;
+        i = lookup(ctx, offset);
+        if (i < 0)
+        {
+            if (length >= ctx->block_size)
+            {
+                // Bulk read, no point to go through buffer
+                temp = read_file(ctx->fd, out, offset, length, &ctx->stats);
+                ctx->stats.cache_miss += temp;
+                total += temp;
+                offset += temp;
+                break;
+            }
+            // Random access, or worker has fallen behind: load synchronously
+            i = take_buffer(ctx, offset);
+            b = &(ctx->buf[i]);
+            b->offset = offset;
+            b->length = read_file(ctx->fd, b->data, offset, ctx->block_size, &ctx->stats);
+            if (0 == b->length)
+                break;
+            loaded = true;
+        }
+        ctx->current = i;
+        b = &(ctx->buf[i]);
+        temp = b->offset + b->length - offset;
+        if (temp > length)
+            temp = length;
+        memcpy(out, b->data + (offset - b->offset), temp);
+        ctx->stats.bytes_copied += temp;
+        if (loaded)
+            ctx->stats.cache_miss += temp;
+        else
+            ctx->stats.cache_hit += temp;
+        total += temp;
+        out += temp;
+        offset += temp;
+        length -= temp;
+    }
+    ctx->pos = offset;
+    reader_stats_count_read(&ctx->stats, start, requested, total);
+
+    if ((ctx->sequential >= PFR_SEQUENTIAL_THRESHOLD) && (ctx->current >= 0))
+        prefetch(ctx);
+
+    return total;
+}
+
+
+static size_t pfr_size(file_reader_t *self)
+{
+    pfr_t *ctx = (pfr_t *)self;
+    return ctx ? ctx->file_size : 0;
+}
+
+
+// Caller side statistics plus I/O done by worker
+static void pfr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    pfr_t *ctx = (pfr_t *)self;
+    *out = ctx->stats;
+    vmutex_lock(&ctx->lock);
+    out->io_reads += ctx->bg_stats.io_reads;
+    out->io_seeks += ctx->bg_stats.io_seeks;
+    out->io_ns += ctx->bg_stats.io_ns;
+    vmutex_unlock(&ctx->lock);
+}
+
+
+file_reader_t * pfreader_create(const char* fn, size_t block_size)
+{
+    pfr_t *ctx = 0;
+    long len;
+    int i;
+
+    if (0 == block_size)
+        return 0;
+
+    ctx = (pfr_t*)VGM_MALLOC(sizeof(pfr_t));
+    if (0 == ctx)
+        return 0;
+    memset(ctx, 0, sizeof(pfr_t));
+
+    do
+    {
+        ctx->fd = fopen(fn, "rb");
+        if (0 == ctx->fd)
+            break;
+        ctx->bg_fd = fopen(fn, "rb");
+        if (0 == ctx->bg_fd)
+            break;
+        if (fseek(ctx->fd, 0, SEEK_END) != 0)
+            break;
+        len = ftell(ctx->fd);
+        if (len < 0)
+            break;
+        ctx->file_size = (size_t)len;
+
+        for (i = 0; i < PFR_BLOCKS; ++i)
+        {
+            ctx->buf[i].data = (uint8_t*)VGM_MALLOC(block_size);
+            if (0 == ctx->buf[i].data)
+                break;
+        }
+        if (i < PFR_BLOCKS)
+            break;
+
+        ctx->block_size = block_size;
+        ctx->current = -1;
+        vmutex_init(&ctx->lock);
+        vcond_init(&ctx->cond);
+        if (vthread_create(&ctx->thread, pfr_worker, ctx) != 0)
+        {
+            vcond_destroy(&ctx->cond);
+            vmutex_destroy(&ctx->lock);
+            break;
+        }
+
+        ctx->super.self = (file_reader_t*)ctx;
+        ctx->super.read = pfr_read;
+        ctx->super.size = pfr_size;
+        ctx->super.borrow = 0;
+        ctx->super.destroy = pfreader_destroy;
+        ctx->super.stats = pfr_stats;
+        ctx->super.readv = 0;
+
+        return (file_reader_t*)ctx;
+
+    } while (0);
+
+    for (i = 0; i < PFR_BLOCKS; ++i)
+    {
+        if (ctx->buf[i].data)
+            VGM_FREE(ctx->buf[i].data);
+    }
+    if (ctx->bg_fd)
+        fclose(ctx->bg_fd);
+    if (ctx->fd)
+        fclose(ctx->fd);
+    VGM_FREE(ctx);
+    return 0;
+}
+
+
+void pfreader_destroy(file_reader_t *pfr)
+{
+    pfr_t* ctx = (pfr_t*)pfr;
+    if (0 == ctx)
+        return;
+    vmutex_lock(&ctx->lock);
+    ctx->quit = true;
+    vcond_broadcast(&ctx->cond);
+    vmutex_unlock(&ctx->lock);
+    vthread_join(ctx->thread);
+    vcond_destroy(&ctx->cond);
+    vmutex_destroy(&ctx->lock);
+    for (int i = 0; i < PFR_BLOCKS; ++i)
+        VGM_FREE(ctx->buf[i].data);
+    fclose(ctx->bg_fd);
+    fclose(ctx->fd);
+    VGM_FREE(ctx);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Prefetching file reader. A small ring of block_size buffers is used: once sequential access
+// is detected a worker thread keeps the next few blocks loaded ahead of the caller. The caller
+// never waits for the worker; on random access, or if the worker has fallen behind, it reads
+// the block itself.
+
+file_reader_t * pfreader_create(const char* fn, size_t block_size);
+
+void pfreader_destroy(file_reader_t* pfr);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "vgm_conf.h"
+#include "reader_factory.h"
+#include "cached_file_reader.h"
+#include "mapped_file_reader.h"
+#include "memory_file_reader.h"
+#include "prefetch_file_reader.h"
+#include "stream_file_reader.h"
+#ifdef VGM_HAVE_ZLIB
+# include "vgz_file_reader.h"
+#endif
+
+
+#define FREADER_BLOCK_SIZE      4096
+#define FREADER_BLOCK_COUNT     8
+#define FREADER_VGZ_SPAN        262144
+
+
+file_reader_t * freader_open(const char* fn, size_t memory_budget, unsigned flags)
+{
+    file_reader_t *reader = 0;
+    struct stat st;
+
+    if (0 == strcmp(fn, "-"))
+        return streamreader_create(stdin, FREADER_SPILL_LIMIT);
+#ifdef VGM_HAVE_ZLIB
+    if (vgzreader_probe(fn))
+        return vgzreader_create(fn, FREADER_VGZ_SPAN);
+#endif
+    if (stat(fn, &st) != 0)
+        return 0;
+    if ((size_t)st.st_size <= memory_budget)
+        reader = memreader_create(fn);
+    else if (flags & FREADER_STREAM)
+        reader = pfreader_create(fn, FREADER_BLOCK_SIZE);
+    else
+        reader = mfreader_create(fn);
+    if (0 == reader)
+        reader = cfreader_create(fn, FREADER_BLOCK_SIZE, FREADER_BLOCK_COUNT);
+    return reader;
+}
+
+
+void freader_close(file_reader_t* reader)
+{
+    if (reader)
+        reader->destroy(reader);
+}
+
+
+static int cmp_range(const void *a, const void *b)
+{
+    const file_range_t *x = *(const file_range_t * const *)a, *y = *(const file_range_t * const *)b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+file_range_t ** freader_sort_ranges(file_range_t* ranges, size_t count, file_range_t** local, size_t local_count)
+{
+    file_range_t **order = local;
+    if ((count > local_count) && (0 == (order = (file_range_t **)VGM_MALLOC(sizeof(file_range_t *) * count))))
+        return 0;
+    for (size_t i = 0; i < count; ++i)
+        order[i] = ranges + i;
+    qsort(order, count, sizeof(file_range_t *), cmp_range);
+    return order;
+}
+
+
+size_t freader_read_ranges(file_reader_t* reader, file_range_t* ranges, size_t count)
+{
+    file_range_t *local[16];
+    file_range_t **order = freader_sort_ranges(ranges, count, local, 16);
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        file_range_t *r = order ? order[i] : ranges + i;     // given order if no memory to sort
+        r->result = reader->read(reader, r->out, r->offset, r->length);
+        total += r->result;
+    }
+    if (order && (order != local))
+        VGM_FREE(order);
+    return total;
+}
+
+
+size_t freader_readv(file_reader_t* reader, file_range_t* ranges, size_t count)
+{
+    if (reader->readv)
+        return reader->readv(reader, ranges, count);
+    return freader_read_ranges(reader, ranges, count);
+}
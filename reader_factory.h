@@ -0,0 +1,46 @@
+#pragma once
+
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Open file with the backend best suited for its size:
+//  - "-": standard input through the stream reader, up to FREADER_SPILL_LIMIT bytes
+//  - gzip compressed file: streaming .vgz reader (when built with zlib)
+//  - file fits in memory_budget: whole file preloaded in memory
+//  - larger file: memory mapped, or prefetching reader if FREADER_STREAM is given,
+//    cached reader if the file can not be mapped
+// Close with freader_close() or reader->destroy()
+
+#define FREADER_DEFAULT_BUDGET  (1024 * 1024)
+
+// Largest input accepted from a pipe, all of it is kept in memory
+#define FREADER_SPILL_LIMIT     (64 * 1024 * 1024)
+
+// Prefer background read-ahead over mmap for large files, i.e. reader is used from
+// real time audio callback where a page fault on slow storage would stall playback
+#define FREADER_STREAM          0x01
+
+file_reader_t * freader_open(const char* fn, size_t memory_budget, unsigned flags);
+
+void freader_close(file_reader_t* reader);
+
+// Vectored read on any reader: uses reader->readv when the backend has one, otherwise reads
+// the ranges in file offset order so neighbouring ranges share cache fills
+size_t freader_readv(file_reader_t* reader, file_range_t* ranges, size_t count);
+
+// Helpers for readv backends. Pointers to ranges sorted by file offset, stored in local when
+// count fits in local_count entries, allocated otherwise (free with VGM_FREE when not local).
+// Returns 0 if out of memory
+file_range_t ** freader_sort_ranges(file_range_t* ranges, size_t count, file_range_t** local, size_t local_count);
+
+// Ranges read one by one with reader->read in file offset order, in given order if out of memory
+size_t freader_read_ranges(file_reader_t* reader, file_range_t* ranges, size_t count);
+
+
+#ifdef __cplusplus
+}
+#endif
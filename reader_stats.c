@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+#include "vgm_conf.h"
+#include "reader_stats.h"
+
+
+void reader_stats_reset(reader_stats_t *st)
+{
+    memset(st, 0, sizeof(reader_stats_t));
+}
+
+
+void reader_stats_count_read(reader_stats_t *st, size_t offset, size_t length, size_t result)
+{
+    int bucket = 0;
+    while ((length > 0) && (bucket < READER_STATS_BUCKETS - 1))
+    {
+        length >>= 1;
+        ++bucket;
+    }
+    ++st->size_histogram[bucket];
+    ++st->read_calls;
+    st->bytes_read += result;
+    if (offset < st->last_offset)
+        ++st->backward_seeks;
+    st->last_offset = offset;
+}
+
+
+uint64_t reader_stats_clock(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (0 == freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1000000000.0 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+uint64_t reader_stats_syscalls(const reader_stats_t *st)
+{
+    return st->io_reads + st->io_seeks + st->io_tells;
+}
+
+
+void reader_stats_print(const reader_stats_t *st)
+{
+    uint64_t total = st->cache_hit + st->cache_miss;
+    VGM_PRINTF("Reader Status: %llu reads, %llu bytes, %llu backward seeks\n",
+        (unsigned long long)st->read_calls, (unsigned long long)st->bytes_read, (unsigned long long)st->backward_seeks);
+    VGM_PRINTF("Cache: (%llu/%llu), hit %.1f%%, %llu bytes copied\n",
+        (unsigned long long)st->cache_hit, (unsigned long long)total, total ? ((double)st->cache_hit * 100.0 / (double)total) : 0.0,
+        (unsigned long long)st->bytes_copied);
+    VGM_PRINTF("I/O: %llu reads, %llu seeks, %llu tells, %.3f ms\n",
+        (unsigned long long)st->io_reads, (unsigned long long)st->io_seeks, (unsigned long long)st->io_tells, (double)st->io_ns / 1000000.0);
+}
+
+
+int reader_stats_to_json(const reader_stats_t *st, char *buf, size_t len)
+{
+    int n, total;
+    total = snprintf(buf, len,
+        "{\"read_calls\":%llu,\"bytes_read\":%llu,\"bytes_copied\":%llu,\"cache_hit\":%llu,\"cache_miss\":%llu,"
+        "\"backward_seeks\":%llu,\"io_reads\":%llu,\"io_seeks\":%llu,\"io_tells\":%llu,\"io_ns\":%llu,\"size_histogram\":[",
+        (unsigned long long)st->read_calls, (unsigned long long)st->bytes_read, (unsigned long long)st->bytes_copied,
+        (unsigned long long)st->cache_hit, (unsigned long long)st->cache_miss, (unsigned long long)st->backward_seeks,
+        (unsigned long long)st->io_reads, (unsigned long long)st->io_seeks, (unsigned long long)st->io_tells,
+        (unsigned long long)st->io_ns);
+    for (int i = 0; i < READER_STATS_BUCKETS; ++i)
+    {
+        n = snprintf(buf + ((size_t)total < len ? (size_t)total : len), (size_t)total < len ? len - (size_t)total : 0,
+            "%s%llu", i ? "," : "", (unsigned long long)st->size_histogram[i]);
+        total += n;
+    }
+    n = snprintf(buf + ((size_t)total < len ? (size_t)total : len), (size_t)total < len ? len - (size_t)total : 0, "]}");
+    return total + n;
+}
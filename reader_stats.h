@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Read size histogram, bucket 0 counts zero length reads, bucket n counts sizes in [2^(n-1), 2^n),
+// last bucket counts everything larger
+#define READER_STATS_BUCKETS    16
+
+
+// I/O statistics collected by file readers
+typedef struct reader_stats_s
+{
+    uint64_t read_calls;        // read() calls
+    uint64_t bytes_read;        // bytes returned by read()
+    uint64_t bytes_copied;      // bytes copied by memcpy inside reader
+    uint64_t cache_hit;         // bytes served without I/O
+    uint64_t cache_miss;        // bytes which needed I/O
+    uint64_t backward_seeks;    // read() starting before the start of previous read
+    uint64_t io_reads;          // fread / pread / ReadFile calls
+    uint64_t io_seeks;          // fseek calls
+    uint64_t io_tells;          // ftell calls
+    uint64_t io_ns;             // time spent in I/O calls
+    uint64_t size_histogram[READER_STATS_BUCKETS];
+    size_t last_offset;         // start of previous read, for backward seek detection
+} reader_stats_t;
+
+
+void reader_stats_reset(reader_stats_t *st);
+
+// Account one read() call
+void reader_stats_count_read(reader_stats_t *st, size_t offset, size_t length, size_t result);
+
+// Monotonic clock in nanoseconds, for io_ns
+uint64_t reader_stats_clock(void);
+
+// Total number of I/O calls
+uint64_t reader_stats_syscalls(const reader_stats_t *st);
+
+void reader_stats_print(const reader_stats_t *st);
+
+// Format as single line JSON object, returns length as snprintf
+int reader_stats_to_json(const reader_stats_t *st, char *buf, size_t len);
+
+
+#ifdef __cplusplus
+}
+#endif
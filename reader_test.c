@@ -1,14 +1,36 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include "vgm_conf.h"
+#include "reader_stats.h"
 #include "cached_file_reader.h"
+#include "mapped_file_reader.h"
+#include "memory_file_reader.h"
+#include "prefetch_file_reader.h"
+#include "shared_file_reader.h"
+#include "pack_file_reader.h"
+#include "stream_file_reader.h"
+#include "corpus_file_reader.h"
+#include "reader_factory.h"
+#ifdef VGM_HAVE_ZLIB
+# include <zlib.h>
+# include "vgz_file_reader.h"
+#endif
+#ifdef VGM_HAVE_IO_URING
+# include "uring_file_reader.h"
+#endif
 
 
 #define BUF_SIZE 4096
 uint8_t buf1[BUF_SIZE], buf2[BUF_SIZE];
 
+#define BENCH_CALLS 200000
+#define BENCH_BULK_MAX 65536
+uint8_t bench_buf[BENCH_BULK_MAX];
+uint32_t bench_latency[BENCH_CALLS];
+
 
 bool compare_buf(uint8_t *buf1, uint8_t *buf2, size_t size)
 {
@@ -41,35 +63,550 @@ bool reader_test(file_reader_t *reader, FILE *fd, size_t offset, size_t len)
 }
 
 
-int main(int argc, char *argv[])
+void show_stats(file_reader_t *reader)
 {
-    if (argc < 2)
+    reader_stats_t st;
+    if (reader->stats)
     {
-        VGM_PRINTERR("Usage: reader_test input\n");
-        return -1;
+        reader->stats(reader, &st);
+        reader_stats_print(&st);
     }
-   
-    FILE *fd;
-    fd = fopen(argv[1], "rb");
-    file_reader_t *reader = cfreader_create(argv[1], 4096);
+}
 
-    time_t t;
-    srand((unsigned)time(&t));
 
+bool random_walk(file_reader_t *reader, FILE *fd, unsigned seed)
+{
     size_t offset = 0, len;
 
+    srand(seed);
     for (int i = 0; i < 10000; ++i)
     {
         offset += (size_t)((rand() % 18));
         len = (size_t)(rand() % 2048);
         VGM_PRINTF("Test\toff=%lu,\tlen=%lu:\t", (unsigned long)offset, (unsigned long)len);
-        if (!reader_test(reader, fd, offset, len)) break;
+        if (!reader_test(reader, fd, offset, len)) return false;
+        if (i % 1000 == 999)
+            offset /= 4;    // jump back, like a loop restart
+    }
+    show_stats(reader);
+    return true;
+}
+
+
+// Borrowed bytes match what read() returns for the same range and stay put until destroy
+bool borrow_test(file_reader_t *reader, unsigned seed)
+{
+    const uint8_t *first = 0, *p;
+    size_t first_len = 0, size = reader->size(reader), available, len;
+
+    srand(seed);
+    for (int n = 0; n < 100; ++n)
+    {
+        size_t offset = (size_t)rand() % (size + 256);
+        size_t length = (size_t)(rand() % BUF_SIZE);
+        VGM_PRINTF("Borrow\toff=%lu,\tlen=%lu:\t", (unsigned long)offset, (unsigned long)length);
+        p = reader->borrow(reader, offset, length, &available);
+        len = reader->read(reader, buf2, offset, length);
+        if ((available != len) || (available > 0 && (0 == p || !compare_buf((uint8_t *)p, buf2, len))))
+        {
+            VGM_PRINTF("failed\n");
+            return false;
+        }
+        VGM_PRINTF("ok\n");
+        if ((0 == first) && (available > 0))
+        {
+            first = p;
+            first_len = available;
+            memcpy(buf1, p, available);
+        }
+    }
+    VGM_PRINTF("Borrow kept:\t");
+    if (first && !compare_buf((uint8_t *)first, buf1, first_len))
+    {
+        VGM_PRINTF("failed\n");
+        return false;
+    }
+    VGM_PRINTF("ok\n");
+    return true;
+}
+
+
+bool readv_test(file_reader_t *reader, FILE *fd, unsigned seed)
+{
+    file_range_t ranges[8];
+    size_t size = reader->size(reader), len;
+
+    srand(seed);
+    for (int n = 0; n < 100; ++n)
+    {
+        // Ranges in random order, some adjacent, some near each other, some past end of file
+        for (int i = 0; i < 8; ++i)
+        {
+            if ((i > 0) && (rand() % 3 == 0))
+                ranges[i].offset = ranges[i - 1].offset + ranges[i - 1].length + (size_t)(rand() % 64);
+            else
+                ranges[i].offset = (size_t)rand() % (size + 256);
+            ranges[i].length = (size_t)(rand() % (BUF_SIZE / 8));
+            ranges[i].out = buf2 + i * (BUF_SIZE / 8);
+        }
+        freader_readv(reader, ranges, 8);
+        for (int i = 0; i < 8; ++i)
+        {
+            VGM_PRINTF("Readv\toff=%lu,\tlen=%lu:\t", (unsigned long)ranges[i].offset, (unsigned long)ranges[i].length);
+            fseek(fd, (long)ranges[i].offset, SEEK_SET);
+            len = fread(buf1, 1, ranges[i].length, fd);
+            if ((len != ranges[i].result) || !compare_buf(buf1, ranges[i].out, len))
+            {
+                VGM_PRINTF("failed\n");
+                return false;
+            }
+            VGM_PRINTF("ok\n");
+        }
+    }
+    return true;
+}
+
+
+/*
+ * Backends under test
+ */
+
+static bool compressed_input(const char *fn)
+{
+#ifdef VGM_HAVE_ZLIB
+    return vgzreader_probe(fn);
+#else
+    (void)fn;
+    return false;
+#endif
+}
+
+static shared_file_t *shared_file = 0;
+static FILE *stream = 0;
+static corpus_t *corpus = 0;
+#ifdef VGM_HAVE_IO_URING
+static urpool_t *uring_pool = 0;
+#endif
+
+static file_reader_t * open_cached(const char *fn) { return cfreader_create(fn, 1024, 4); }
+static file_reader_t * open_mapped(const char *fn) { return mfreader_create(fn); }
+static file_reader_t * open_memory(const char *fn) { return memreader_create(fn); }
+static file_reader_t * open_prefetch(const char *fn) { return pfreader_create(fn, 4096); }
+static file_reader_t * open_shared(const char *fn)
+{
+    shared_file = sfile_open(fn);
+    return shared_file ? sfreader_create(shared_file, 4096) : 0;
+}
+static file_reader_t * open_stream(const char *fn)
+{
+    stream = fopen(fn, "rb");
+    return stream ? streamreader_create(stream, 1 << 30) : 0;
+}
+static file_reader_t * open_corpus(const char *fn)
+{
+    corpus = corpus_create();
+    if (!corpus || !corpus_add(corpus, "test", fn))
+        return 0;
+    // stderr, stdout carries JSON in benchmark mode
+    VGM_PRINTERR("Corpus %lu bytes in %lu bytes\n", (unsigned long)corpus_raw_size(corpus), (unsigned long)corpus_memory(corpus));
+    return corpus_reader_create(corpus, "test", 4);
+}
+
+// Pack with a short member ahead of the file under test, so reads go through a non-zero member offset
+#define PACK_FILE "reader_test.vpk"
+static vpack_t *pack = 0;
+static void put_le(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; ++i)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+static file_reader_t * open_pack(const char *fn)
+{
+    uint8_t head[VPACK_HEADER_SIZE + 2 * (VPACK_ENTRY_SIZE + 4)] = { 'V', 'P', 'A', 'K' };
+    uint8_t *e = head + VPACK_HEADER_SIZE;
+    size_t n, data = sizeof(head) + 5;
+    FILE *in = fopen(fn, "rb"), *out = fopen(PACK_FILE, "wb");
+    if (in && out)
+    {
+        fseek(in, 0, SEEK_END);
+        put_le(head + 4, VPACK_VERSION, 4);
+        put_le(head + 8, 2, 4);
+        put_le(head + 12, 2 * (VPACK_ENTRY_SIZE + 4), 4);
+        put_le(e, sizeof(head), 8);
+        put_le(e + 8, 5, 8);
+        put_le(e + 16, 4, 2);
+        memcpy(e + VPACK_ENTRY_SIZE, "head", 4);
+        e += VPACK_ENTRY_SIZE + 4;
+        put_le(e, data, 8);
+        put_le(e + 8, (uint64_t)ftell(in), 8);
+        put_le(e + 16, 4, 2);
+        memcpy(e + VPACK_ENTRY_SIZE, "test", 4);
+        fwrite(head, 1, sizeof(head), out);
+        fwrite("hello", 1, 5, out);
+        fseek(in, 0, SEEK_SET);
+        while ((n = fread(buf1, 1, BUF_SIZE, in)) > 0)
+            fwrite(buf1, 1, n, out);
+    }
+    if (in) fclose(in);
+    if (out) fclose(out);
+    pack = vpack_open(PACK_FILE);
+    return pack ? vpack_reader_create(pack, "test") : 0;
+}
+
+#ifdef VGM_HAVE_IO_URING
+static file_reader_t * open_uring(const char *fn)
+{
+    uring_pool = urpool_create(8, 1);
+    return uring_pool ? urpool_reader_create(uring_pool, fn, 4096) : 0;
+}
+#endif
+
+static void close_reader(file_reader_t *reader)
+{
+    reader->destroy(reader);
+    if (shared_file)
+        sfile_close(shared_file);
+    shared_file = 0;
+    if (stream)
+        fclose(stream);
+    stream = 0;
+    if (corpus)
+        corpus_destroy(corpus);
+    corpus = 0;
+    if (pack)
+    {
+        vpack_close(pack);
+        remove(PACK_FILE);
+    }
+    pack = 0;
+#ifdef VGM_HAVE_IO_URING
+    if (uring_pool)
+        urpool_destroy(uring_pool);
+    uring_pool = 0;
+#endif
+}
+#ifdef VGM_HAVE_ZLIB
+static file_reader_t * open_vgz(const char *fn) { return vgzreader_create(fn, 65536); }
+#endif
+
+typedef struct backend_s
+{
+    const char *name;
+    file_reader_t * (*open)(const char *fn);
+    bool compressed;    // needs gzip input
+} backend_t;
+
+static const backend_t backends[] =
+{
+    { "cached",     open_cached,    false },
+    { "mapped",     open_mapped,    false },
+    { "memory",     open_memory,    false },
+    { "prefetch",   open_prefetch,  false },
+    { "shared",     open_shared,    false },
+    { "pack",       open_pack,      false },
+    { "stream",     open_stream,    false },
+    { "corpus",     open_corpus,    false },
+#ifdef VGM_HAVE_IO_URING
+    { "uring",      open_uring,     false },
+#endif
+#ifdef VGM_HAVE_ZLIB
+    { "vgz",        open_vgz,       true },
+#endif
+};
+#define BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+
+/*
+ * Benchmark workloads, deterministic across platforms
+ */
+
+#define WORKLOAD_SEQUENTIAL 0   // command stream: small reads walking forward, restart at end of file
+#define WORKLOAD_LOOPBACK   1   // command stream with loop restart every 64 KB and periodic data block fetch
+#define WORKLOAD_SCATTERED  2   // small reads at random offsets
+#define WORKLOAD_BULK       3   // large reads at random offsets
+#define WORKLOADS           4
+
+static const char *workload_names[WORKLOADS] = { "sequential", "loopback", "scattered", "bulk" };
+static const int workload_calls[WORKLOADS] = { BENCH_CALLS, BENCH_CALLS, BENCH_CALLS / 10, BENCH_CALLS / 100 };
+
+
+static uint32_t lcg(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+static void bench(const backend_t *be, const char *fn, int workload)
+{
+    file_reader_t *reader = be->open(fn);
+    reader_stats_t st;
+    uint32_t seed = 12345;
+    size_t size, offset = 0, len, loop_start = 0;
+    uint64_t bytes = 0, t0, t1, t;
+    double sec, hit;
+    int calls = workload_calls[workload];
+
+    if (0 == reader)
+    {
+        printf("{\"backend\":\"%s\",\"workload\":\"%s\",\"error\":\"open failed\"}\n", be->name, workload_names[workload]);
+        return;
+    }
+    size = reader->size(reader);
+    if (0 == size)
+    {
+        close_reader(reader);
+        return;
+    }
+    loop_start = size / 4;
+
+    t0 = reader_stats_clock();
+    for (int i = 0; i < calls; ++i)
+    {
+        switch (workload)
+        {
+        case WORKLOAD_SEQUENTIAL:
+            len = 1 + lcg(&seed) % 8;
+            if (offset >= size)
+                offset = 0;
+            break;
+        case WORKLOAD_LOOPBACK:
+            len = 1 + lcg(&seed) % 8;
+            if ((offset >= size) || (offset >= loop_start + 65536))
+                offset = loop_start;
+            if (i % 256 == 255)
+            {
+                // data block fetch somewhere else, command stream continues afterwards
+                t = reader_stats_clock();
+                bytes += reader->read(reader, bench_buf, lcg(&seed) % size, 256);
+                bench_latency[i] = (uint32_t)(reader_stats_clock() - t);
+                continue;
+            }
+            break;
+        case WORKLOAD_SCATTERED:
+            len = 1 + lcg(&seed) % 64;
+            offset = lcg(&seed) % size;
+            break;
+        default:
+            len = 16384 + lcg(&seed) % (BENCH_BULK_MAX - 16384);
+            offset = lcg(&seed) % size;
+            break;
+        }
+        t = reader_stats_clock();
+        len = reader->read(reader, bench_buf, offset, len);
+        bench_latency[i] = (uint32_t)(reader_stats_clock() - t);
+        bytes += len;
+        offset += len;
+        if (0 == len)
+            offset = size;
+    }
+    t1 = reader_stats_clock();
+
+    reader_stats_reset(&st);
+    if (reader->stats)
+        reader->stats(reader, &st);
+    close_reader(reader);
+
+    qsort(bench_latency, (size_t)calls, sizeof(uint32_t), cmp_u32);
+    sec = (double)(t1 - t0) / 1e9;
+    hit = (st.cache_hit + st.cache_miss) ? (double)st.cache_hit / (double)(st.cache_hit + st.cache_miss) : 0.0;
+    printf("{\"backend\":\"%s\",\"workload\":\"%s\",\"calls\":%d,\"bytes\":%llu,\"seconds\":%.6f,"
+        "\"mb_per_s\":%.2f,\"calls_per_s\":%.0f,\"p50_ns\":%u,\"p99_ns\":%u,\"hit_rate\":%.4f,\"syscalls\":%llu}\n",
+        be->name, workload_names[workload], calls, (unsigned long long)bytes, sec,
+        (double)bytes / 1048576.0 / sec, (double)calls / sec,
+        bench_latency[calls / 2], bench_latency[calls * 99 / 100], hit,
+        (unsigned long long)reader_stats_syscalls(&st));
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool benchmark = false;
+    const char *fn;
+
+    if ((argc > 2) && (0 == strcmp(argv[1], "-b")))
+        benchmark = true;
+    if (argc < (benchmark ? 3 : 2))
+    {
+        VGM_PRINTERR("Usage: reader_test [-b] input\n");
+        VGM_PRINTERR("  -b  benchmark all readers, one JSON object per backend and workload\n");
+        return -1;
+    }
+    fn = argv[benchmark ? 2 : 1];
+
+    if (benchmark)
+    {
+        for (size_t b = 0; b < BACKENDS; ++b)
+        {
+            if (backends[b].compressed != compressed_input(fn))
+                continue;
+            for (int w = 0; w < WORKLOADS; ++w)
+                bench(backends + b, fn, w);
+        }
+        return 0;
+    }
+
+    FILE *fd;
+    fd = fopen(fn, "rb");
+    if (0 == fd)
+    {
+        VGM_PRINTERR("Unable to open %s\n", fn);
+        return -1;
+    }
+
+    time_t t;
+    unsigned seed = (unsigned)time(&t);
+    size_t len1;
+    int r = 0;
+
+#ifdef VGM_HAVE_ZLIB
+    if (compressed_input(fn))
+    {
+        // Compressed input, compare gzip reader against decompressed copy
+        uint8_t *chunk = buf1;
+        int got;
+        gzFile gz = gzopen(fn, "rb");
+        fclose(fd);
+        fd = tmpfile();
+        while ((got = gzread(gz, chunk, BUF_SIZE)) > 0)
+            fwrite(chunk, 1, (size_t)got, fd);
+        gzclose(gz);
+    }
+#endif
+
+    for (size_t b = 0; b < BACKENDS; ++b)
+    {
+        if (backends[b].compressed != compressed_input(fn))
+            continue;
+        VGM_PRINTF("Reader: %s\n", backends[b].name);
+        file_reader_t *reader = backends[b].open(fn);
+        if (!reader || !random_walk(reader, fd, seed) || !readv_test(reader, fd, seed)) r = -1;
+        if (reader && reader->borrow && !borrow_test(reader, seed)) r = -1;
+        if (reader) close_reader(reader);
+    }
+
+    if (!compressed_input(fn))
+    {
+        // Two shared file readers on one file, interleaved
+        shared_file_t *sf = sfile_open(fn);
+        file_reader_t *other = sfreader_create(sf, 4096);
+        file_reader_t *reader = sfreader_create(sf, 4096);
+        other->read(other, buf2, 0, 16);
+        if (!random_walk(reader, fd, seed)) r = -1;
+        if (!reader_test(other, fd, 16, 1024)) r = -1;
+        sfreader_destroy(other);
+        sfreader_destroy(reader);
+        sfile_close(sf);
+    }
+
+    if (!compressed_input(fn))
+    {
+        // Prefetch reader walking forward, worker keeps blocks ahead, a jump back takes a queued block
+        file_reader_t *reader = pfreader_create(fn, 4096);
+        size_t offset = 0, size = reader->size(reader);
+        for (int n = 0; n < 2; ++n)
+        {
+            for (offset = (size_t)n * size / 2; offset < size; offset += 300)
+            {
+                VGM_PRINTF("Prefetch\toff=%lu:\t", (unsigned long)offset);
+                if (!reader_test(reader, fd, offset, 300)) r = -1;
+            }
+        }
+        show_stats(reader);
+        pfreader_destroy(reader);
+    }
+
+    if (!compressed_input(fn))
+    {
+        // Cached reader: hits, size() and current position reads make no system call
+        file_reader_t *reader = cfreader_create(fn, 1024, 4);
+        reader_stats_t before, after;
+        size_t len0 = reader->read(reader, buf2, 100, 50);
+        reader->stats(reader, &before);
+        VGM_PRINTF("Cache hit:\t");
+        if (!reader_test(reader, fd, 100, 50)) r = -1;
+        reader->size(reader);
+        VGM_PRINTF("Position:\t");
+        fseek(fd, 100, SEEK_SET);
+        len1 = fread(buf1, 1, 60, fd);
+        len1 = (len1 > 50) ? len1 - 50 : 0;
+        memmove(buf1, buf1 + 50, len1);
+        if ((reader->read(reader, buf2, (size_t)-1, 10) != len1) || !compare_buf(buf1, buf2, len1))
+        {
+            VGM_PRINTF("failed\n");
+            r = -1;
+        }
+        else
+            VGM_PRINTF("ok\n");
+        reader->stats(reader, &after);
+        VGM_PRINTF("No syscalls:\t");
+        if ((reader_stats_syscalls(&after) != reader_stats_syscalls(&before)) || (after.cache_hit - before.cache_hit != len0 + len1))
+        {
+            VGM_PRINTF("failed\n");
+            r = -1;
+        }
+        else
+            VGM_PRINTF("ok\n");
+        cfreader_destroy(reader);
+    }
+
+    if (!compressed_input(fn))
+    {
+        // Stream larger than spill limit, reads past the limit fail with an error
+        FILE *in = fopen(fn, "rb");
+        file_reader_t *reader = streamreader_create(in, 1000);
+        size_t len;
+        fseek(fd, 0, SEEK_END);
+        len = (size_t)ftell(fd);
+        VGM_PRINTF("Stream limit:\t");
+        if ((reader->read(reader, buf2, 900, 200) != ((len > 1000) ? 100 : (len > 900 ? len - 900 : 0)))
+            || ((len > 1000) != (0 != streamreader_error(reader))))
+        {
+            VGM_PRINTF("failed\n");
+            r = -1;
+        }
+        else
+            VGM_PRINTF("ok\n");
+        streamreader_destroy(reader);
+        fclose(in);
+    }
+
+#ifdef VGM_HAVE_IO_URING
+    urpool_t *pool = compressed_input(fn) ? 0 : urpool_create(4, 4);
+    if (pool)
+    {
+        // Readers on one pool walking the file in turn, refills submitted 4 at a time. Depth is
+        // below 2 per reader, so misses have to wait for a free slot
+        file_reader_t *walkers[4];
+        size_t offset[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            walkers[i] = urpool_reader_create(pool, fn, 4096);
+            offset[i] = (size_t)i * 10000;
+        }
+        for (int n = 0; (n < 1000) && walkers[0]; ++n)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                VGM_PRINTF("Pool %d\toff=%lu:\t", i, (unsigned long)offset[i]);
+                if (!walkers[i] || !reader_test(walkers[i], fd, offset[i], 300)) r = -1;
+                offset[i] += 300;
+            }
+        }
+        for (int i = 0; i < 4; ++i)
+            urpool_reader_destroy(walkers[i]);
+        urpool_destroy(pool);
     }
-    
-    cfreader_show_cache_status(reader);
+#endif
 
-    cfreader_destroy(reader);
     fclose(fd);
 
-    return 0;
+    return r;
 }
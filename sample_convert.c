@@ -0,0 +1,18 @@
+#include "sample_convert.h"
+
+
+#define S16_SCALE   (1.0f / 32768.0f)
+
+
+void sample_s16_to_f32(const int16_t* in, float* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (float)in[i] * S16_SCALE;
+}
+
+
+void sample_s16_to_s32(const int16_t* in, int32_t* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = (int32_t)((uint32_t)(int32_t)in[i] << 16);
+}
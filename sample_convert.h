@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Sample format conversion for .wav dumps. Input is decoder output, already mixed and clipped to
+// 16 bits by the core, so the wider formats are widened 16 bit data with no extra resolution or
+// headroom.
+
+// int16 to float in -1.0 .. +1.0
+void sample_s16_to_f32(const int16_t* in, float* out, size_t n);
+
+// int16 to int32 full scale (sample << 16)
+void sample_s16_to_s32(const int16_t* in, int32_t* out, size_t n);
+
+
+#ifdef __cplusplus
+}
+#endif
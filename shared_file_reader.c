@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+# include <sys/uio.h>
+#endif
+#include "vgm_conf.h"
+#include "shared_file_reader.h"
+#include "reader_factory.h"
+#include "reader_stats.h"
+#include "pread_full.h"
+
+
+// Most ranges merged into one vectored read
+#define SFR_IOV_MAX     64
+
+
+// Shared file, read-only after open
+struct shared_file_s
+{
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int fd;
+#endif
+    size_t size;
+};
+
+
+// Shared File Reader, one per caller
+typedef struct sfr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    shared_file_t* sf;
+    uint8_t* cache;
+    size_t cache_size;
+    size_t cache_length;
+    size_t cache_offset;
+    size_t pos;
+    reader_stats_t stats;
+} sfr_t;
+
+
+// Positional read, retries short reads until length or end of file
+static size_t sfile_pread(shared_file_t *sf, uint8_t *out, size_t offset, size_t length, reader_stats_t *st)
+{
+#ifdef _WIN32
+    return pread_full(sf->file, out, offset, length, sf->size, st);
+#else
+    return pread_full(sf->fd, out, offset, length, sf->size, st);
+#endif
+}
+
+
+static size_t sfr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    sfr_t *ctx = (sfr_t *)self;
+    size_t total = 0, temp, start, requested = length;
+    bool loaded = false;
+
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    start = offset;
+
+    while (length > 0)
+    {
+        if ((ctx->cache_length > 0) && (offset >= ctx->cache_offset) && (offset < ctx->cache_offset + ctx->cache_length))
+        {
+            temp = ctx->cache_offset + ctx->cache_length - offset;
+            if (temp > length)
+                temp = length;
+            memcpy(out, ctx->cache + (offset - ctx->cache_offset), temp);
+            ctx->stats.bytes_copied += temp;
+            if (loaded)
+                ctx->stats.cache_miss += temp;
+            else
+                ctx->stats.cache_hit += temp;
+            total += temp;
+            out += temp;
+            offset += temp;
+            length -= temp;
+        }
+        else if (length >= ctx->cache_size)
+        {
+            // Bulk read, bypass cache
+            temp = sfile_pread(ctx->sf, out, offset, length, &ctx->stats);
+            ctx->stats.cache_miss += temp;
+            total += temp;
+            offset += temp;
+            break;
+        }
+        else
+        {
+            ctx->cache_offset = offset;
+            ctx->cache_length = sfile_pread(ctx->sf, ctx->cache, offset, ctx->cache_size, &ctx->stats);
+            if (0 == ctx->cache_length)
+                break;
+            loaded = true;
+        }
+    }
+    ctx->pos = offset;
+    reader_stats_count_read(&ctx->stats, start, requested, total);
+    return total;
+}
+
+
+/*
+ * Vectored read. Ranges are sorted by offset, ranges not in cache which follow each other
+ * with gaps smaller than the cache are read with one preadv straight into the caller's
+ * buffers, gap bytes land in the cache buffer and are dropped. Everything else goes
+ * through sfr_read(). Windows has no scatter read into arbitrary buffers, ranges are only
+ * sorted there.
+ */
+
+static size_t sfr_readv(file_reader_t *self, file_range_t *ranges, size_t count)
+{
+    sfr_t *ctx = (sfr_t *)self;
+    file_range_t *local[16];
+    file_range_t **order;
+    size_t total = 0, i, j;
+
+    if (0 == (order = freader_sort_ranges(ranges, count, local, 16)))
+        return freader_read_ranges(self, ranges, count);
+
+    for (i = 0; i < count; i = j)
+    {
+        j = i + 1;
+#ifndef _WIN32
+        struct iovec iov[SFR_IOV_MAX];
+        int n = 0;
+        size_t end = order[i]->offset, want = 0;
+        while ((j <= count) && (n < SFR_IOV_MAX - 1))
+        {
+            file_range_t *q = order[j - 1];
+            size_t len = q->length;
+            if ((q->offset >= ctx->sf->size) || (0 == len) || (q->offset < end) || (q->offset - end > ctx->cache_size)
+                || ((ctx->cache_length > 0) && (q->offset >= ctx->cache_offset) && (q->offset < ctx->cache_offset + ctx->cache_length)))
+                break;
+            if (len > ctx->sf->size - q->offset)
+                len = ctx->sf->size - q->offset;
+            if (q->offset > end)
+            {
+                iov[n].iov_base = ctx->cache;
+                iov[n++].iov_len = q->offset - end;
+            }
+            iov[n].iov_base = q->out;
+            iov[n++].iov_len = len;
+            end = q->offset + len;
+            want += len;
+            ++j;
+        }
+        --j;
+        if (j - i >= 2)
+        {
+            // Ranges [i, j) in one call, retry is left to sfr_read() below if short
+            ssize_t got;
+            uint64_t t = reader_stats_clock();
+            ++ctx->stats.io_reads;
+            got = preadv(ctx->sf->fd, iov, n, (off_t)order[i]->offset);
+            ctx->stats.io_ns += reader_stats_clock() - t;
+            ctx->cache_length = 0;
+            if (got == (ssize_t)(end - order[i]->offset))
+            {
+                for (size_t k = i; k < j; ++k)
+                {
+                    file_range_t *q = order[k];
+                    q->result = (q->length < ctx->sf->size - q->offset) ? q->length : ctx->sf->size - q->offset;
+                    ctx->stats.cache_miss += q->result;
+                    reader_stats_count_read(&ctx->stats, q->offset, q->length, q->result);
+                    total += q->result;
+                }
+                ctx->pos = end;
+                continue;
+            }
+        }
+        j = i + 1;
+#endif
+        order[i]->result = sfr_read(self, order[i]->out, order[i]->offset, order[i]->length);
+        total += order[i]->result;
+    }
+
+    if (order != local)
+        VGM_FREE(order);
+    return total;
+}
+
+
+static size_t sfr_size(file_reader_t *self)
+{
+    sfr_t *ctx = (sfr_t *)self;
+    return ctx ? ctx->sf->size : 0;
+}
+
+
+static void sfr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((sfr_t *)self)->stats;
+}
+
+
+shared_file_t * sfile_open(const char* fn)
+{
+    shared_file_t *sf = (shared_file_t*)VGM_MALLOC(sizeof(shared_file_t));
+    if (0 == sf)
+        return 0;
+#ifdef _WIN32
+    LARGE_INTEGER len;
+    sf->file = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == sf->file)
+    {
+        VGM_FREE(sf);
+        return 0;
+    }
+    if (!GetFileSizeEx(sf->file, &len))
+    {
+        CloseHandle(sf->file);
+        VGM_FREE(sf);
+        return 0;
+    }
+    sf->size = (size_t)len.QuadPart;
+#else
+    struct stat st;
+    sf->fd = open(fn, O_RDONLY);
+    if (sf->fd < 0)
+    {
+        VGM_FREE(sf);
+        return 0;
+    }
+    if (fstat(sf->fd, &st) != 0)
+    {
+        close(sf->fd);
+        VGM_FREE(sf);
+        return 0;
+    }
+    sf->size = (size_t)st.st_size;
+#endif
+    return sf;
+}
+
+
+void sfile_close(shared_file_t* sf)
+{
+    if (0 == sf)
+        return;
+#ifdef _WIN32
+    CloseHandle(sf->file);
+#else
+    close(sf->fd);
+#endif
+    VGM_FREE(sf);
+}
+
+
+file_reader_t * sfreader_create(shared_file_t* sf, size_t cache_size)
+{
+    sfr_t *ctx;
+
+    if ((0 == sf) || (0 == cache_size))
+        return 0;
+
+    ctx = (sfr_t*)VGM_MALLOC(sizeof(sfr_t));
+    if (0 == ctx)
+        return 0;
+
+    ctx->cache = (uint8_t*)VGM_MALLOC(cache_size);
+    if (0 == ctx->cache)
+    {
+        VGM_FREE(ctx);
+        return 0;
+    }
+
+    ctx->sf = sf;
+    ctx->cache_size = cache_size;
+    ctx->cache_length = 0;
+    ctx->cache_offset = 0;
+    ctx->pos = 0;
+    reader_stats_reset(&ctx->stats);
+
+    ctx->super.self = (file_reader_t*)ctx;
+    ctx->super.read = sfr_read;
+    ctx->super.size = sfr_size;
+    ctx->super.borrow = 0;
+    ctx->super.destroy = sfreader_destroy;
+    ctx->super.stats = sfr_stats;
+    ctx->super.readv = sfr_readv;
+
+    return (file_reader_t*)ctx;
+}
+
+
+void sfreader_destroy(file_reader_t *sfr)
+{
+    sfr_t* ctx = (sfr_t*)sfr;
+    if (0 == ctx)
+        return;
+    VGM_FREE(ctx->cache);
+    VGM_FREE(ctx);
+}
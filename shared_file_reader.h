@@ -0,0 +1,28 @@
+#pragma once
+
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Shared file reader. A file opened once with sfile_open() can back any number of readers,
+// each with its own cache and position, used concurrently from different threads.
+// All I/O is positional (pread), no file offset is shared between readers.
+
+typedef struct shared_file_s shared_file_t;
+
+shared_file_t * sfile_open(const char* fn);
+
+// All readers created on the file must be destroyed before closing it
+void sfile_close(shared_file_t* sf);
+
+file_reader_t * sfreader_create(shared_file_t* sf, size_t cache_size);
+
+void sfreader_destroy(file_reader_t* sfr);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef _WIN32
+# include <io.h>
+# include <fcntl.h>
+#endif
+#include "vgm_conf.h"
+#include "stream_file_reader.h"
+#include "reader_stats.h"
+
+
+// Bytes pulled from the stream per read, and initial spill size
+#define STR_CHUNK   65536
+
+
+// Stream File Reader
+typedef struct str_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    FILE* fd;
+    uint8_t* spill;
+    size_t capacity;        // allocated spill
+    size_t length;          // bytes received from stream so far
+    size_t max_size;
+    size_t pos;
+    bool eof;               // end of stream seen, length is file size
+    const char* error;
+    reader_stats_t stats;
+} str_t;
+
+
+static void set_error(str_t *ctx, const char *error)
+{
+    if (0 == ctx->error)
+    {
+        ctx->error = error;
+        VGM_PRINTERR("Stream reader: %s\n", error);
+    }
+}
+
+
+// Receive from stream until spill holds end bytes or stream ends. Returns false on error or
+// if the stream continues past spill limit
+static bool fetch(str_t *ctx, size_t end)
+{
+    while (!ctx->eof && (ctx->length < end))
+    {
+        size_t want, got;
+        uint64_t t;
+        if (ctx->length == ctx->max_size)
+        {
+            // Spill is full, fine only if stream ends exactly here
+            int c = fgetc(ctx->fd);
+            if (EOF == c)
+            {
+                ctx->eof = true;
+                break;
+            }
+            ungetc(c, ctx->fd);
+            return false;
+        }
+        if (ctx->length == ctx->capacity)
+        {
+            // Grow by doubling, up to limit
+            size_t capacity = ctx->capacity * 2;
+            uint8_t *spill;
+            if (capacity > ctx->max_size)
+                capacity = ctx->max_size;
+            spill = (uint8_t*)VGM_MALLOC(capacity);
+            if (0 == spill)
+            {
+                set_error(ctx, "out of memory for spill buffer");
+                return false;
+            }
+            memcpy(spill, ctx->spill, ctx->length);
+            VGM_FREE(ctx->spill);
+            ctx->spill = spill;
+            ctx->capacity = capacity;
+        }
+        want = ctx->capacity - ctx->length;
+        if (want > STR_CHUNK)
+            want = STR_CHUNK;
+        t = reader_stats_clock();
+        ++ctx->stats.io_reads;
+        got = fread(ctx->spill + ctx->length, 1, want, ctx->fd);
+        ctx->stats.io_ns += reader_stats_clock() - t;
+        ctx->length += got;
+        if (got < want)
+        {
+            ctx->eof = true;
+            if (ferror(ctx->fd))
+            {
+                set_error(ctx, "read error on input stream");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+static size_t str_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    str_t *ctx = (str_t *)self;
+    size_t available, received = ctx->length;
+
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    if ((offset >= ctx->max_size) || (length > ctx->max_size - offset))
+    {
+        // Past the limit, fine only if the stream ends before
+        if (!fetch(ctx, (size_t)-1) && !ctx->error)
+            set_error(ctx, "read beyond spill limit, input is larger than allowed");
+    }
+    else if (ctx->length < offset + length)
+        fetch(ctx, offset + length);
+    available = (offset < ctx->length) ? ctx->length - offset : 0;
+    if (available > length)
+        available = length;
+    if (available > 0)
+    {
+        // Bytes received from stream during this call are misses, the rest came from spill
+        size_t fresh = (offset + available > received) ? offset + available - (offset > received ? offset : received) : 0;
+        memcpy(out, ctx->spill + offset, available);
+        ctx->stats.bytes_copied += available;
+        ctx->stats.cache_miss += fresh;
+        ctx->stats.cache_hit += available - fresh;
+        ctx->pos = offset + available;
+    }
+    reader_stats_count_read(&ctx->stats, offset, length, available);
+    return available;
+}
+
+
+static size_t str_size(file_reader_t *self)
+{
+    str_t *ctx = (str_t *)self;
+    if (0 == ctx)
+        return 0;
+    // Only way to know the size of a stream is to read it all
+    if (!fetch(ctx, (size_t)-1) && !ctx->error)
+        set_error(ctx, "input is larger than spill limit");
+    return ctx->length;
+}
+
+
+static void str_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((str_t *)self)->stats;
+}
+
+
+file_reader_t * streamreader_create(FILE* fd, size_t max_size)
+{
+    str_t *ctx;
+
+    if ((0 == fd) || (0 == max_size))
+        return 0;
+
+    ctx = (str_t*)VGM_MALLOC(sizeof(str_t));
+    if (0 == ctx)
+        return 0;
+    memset(ctx, 0, sizeof(str_t));
+
+    ctx->capacity = (max_size < STR_CHUNK) ? max_size : STR_CHUNK;
+    ctx->spill = (uint8_t*)VGM_MALLOC(ctx->capacity);
+    if (0 == ctx->spill)
+    {
+        VGM_FREE(ctx);
+        return 0;
+    }
+#ifdef _WIN32
+    // stdin is opened in text mode
+    _setmode(_fileno(fd), _O_BINARY);
+#endif
+    ctx->fd = fd;
+    ctx->max_size = max_size;
+    reader_stats_reset(&ctx->stats);
+
+    ctx->super.self = (file_reader_t*)ctx;
+    ctx->super.read = str_read;
+    ctx->super.size = str_size;
+    ctx->super.borrow = 0;      // spill moves when it grows
+    ctx->super.destroy = streamreader_destroy;
+    ctx->super.stats = str_stats;
+    ctx->super.readv = 0;
+
+    return (file_reader_t*)ctx;
+}
+
+
+void streamreader_destroy(file_reader_t *sr)
+{
+    str_t* ctx = (str_t*)sr;
+    if (0 == ctx)
+        return;
+    VGM_FREE(ctx->spill);
+    VGM_FREE(ctx);
+}
+
+
+const char * streamreader_error(file_reader_t* sr)
+{
+    return sr ? ((str_t *)sr)->error : 0;
+}
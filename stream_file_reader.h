@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdio.h>
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Stream reader for input which can not seek, e.g. pipe or stdin. The stream is read forward
+// only as far as requested, everything read is kept in a spill buffer growing up to max_size
+// so earlier offsets (loop restart, data blocks) can be read again. size() has to drain the
+// stream to find its end, up to max_size. vgmcore calls size() when it is created, so a player
+// on top of it waits for the whole stream before the first sample, there is no progressive
+// playback.
+// Reading beyond max_size fails, the reader reports it once on stderr and streamreader_error()
+// returns the reason.
+
+file_reader_t * streamreader_create(FILE* fd, size_t max_size);
+
+// Stream is not closed, caller owns it
+void streamreader_destroy(file_reader_t* sr);
+
+// Description of the first error, NULL if none
+const char * streamreader_error(file_reader_t* sr);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vgm_conf.h"
+#include "vgm_thread.h"
+#include "trace_file_reader.h"
+#include "reader_stats.h"
+
+
+#define TRACE_BUFFER_RECORDS    512
+
+
+// Trace file with its record buffer, shared by all readers logging to it. Readers may run on
+// different threads, e.g. audio callback and seek
+typedef struct trace_sink_s
+{
+    FILE* trace;
+    unsigned refs;
+    vmutex_t lock;
+    size_t records;
+    uint8_t buffer[TRACE_BUFFER_RECORDS * TRACE_RECORD_SIZE];
+} trace_sink_t;
+
+
+// Trace File Reader
+typedef struct trr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    file_reader_t* inner;
+    trace_sink_t* sink;
+    size_t pos;             // end of last read, current position reads are logged at it
+} trr_t;
+
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+
+// Lock held
+static void flush_records(trace_sink_t *sink)
+{
+    if (sink->records > 0)
+        fwrite(sink->buffer, TRACE_RECORD_SIZE, sink->records, sink->trace);
+    sink->records = 0;
+}
+
+
+static void add_record(trr_t *ctx, size_t offset, size_t length)
+{
+    trace_sink_t *sink = ctx->sink;
+    uint8_t *rec;
+    vmutex_lock(&sink->lock);
+    rec = sink->buffer + sink->records * TRACE_RECORD_SIZE;
+    put_u32(rec, ((size_t)-1 == offset) ? 0xffffffff : (uint32_t)offset);
+    put_u32(rec + 4, (uint32_t)length);
+    if (++sink->records == TRACE_BUFFER_RECORDS)
+        flush_records(sink);
+    vmutex_unlock(&sink->lock);
+}
+
+
+static size_t trr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    trr_t *ctx = (trr_t *)self;
+    size_t got;
+    // Other readers may log in between, so the trace can not rely on the previous record
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    add_record(ctx, offset, length);
+    got = ctx->inner->read(ctx->inner, out, offset, length);
+    ctx->pos = offset + got;
+    return got;
+}
+
+
+static const uint8_t * trr_borrow(file_reader_t *self, size_t offset, size_t length, size_t *available)
+{
+    trr_t *ctx = (trr_t *)self;
+    add_record(ctx, offset, length);
+    return ctx->inner->borrow(ctx->inner, offset, length, available);
+}
+
+
+static size_t trr_readv(file_reader_t *self, file_range_t *ranges, size_t count)
+{
+    trr_t *ctx = (trr_t *)self;
+    for (size_t i = 0; i < count; ++i)
+        add_record(ctx, ranges[i].offset, ranges[i].length);
+    return ctx->inner->readv(ctx->inner, ranges, count);
+}
+
+
+static size_t trr_size(file_reader_t *self)
+{
+    trr_t *ctx = (trr_t *)self;
+    return ctx->inner->size(ctx->inner);
+}
+
+
+static void trr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    trr_t *ctx = (trr_t *)self;
+    if (ctx->inner->stats)
+        ctx->inner->stats(ctx->inner, out);
+    else
+        reader_stats_reset(out);
+}
+
+
+static file_reader_t * create(file_reader_t* inner, trace_sink_t* sink)
+{
+    trr_t *ctx = (trr_t*)VGM_MALLOC(sizeof(trr_t));
+    if (0 == ctx)
+        return 0;
+
+    ctx->inner = inner;
+    ctx->sink = sink;
+    ctx->pos = 0;
+
+    ctx->super.self = (file_reader_t*)ctx;
+    ctx->super.read = trr_read;
+    ctx->super.size = trr_size;
+    ctx->super.borrow = inner->borrow ? trr_borrow : 0;
+    ctx->super.destroy = trreader_destroy;
+    ctx->super.stats = trr_stats;
+    ctx->super.readv = inner->readv ? trr_readv : 0;
+
+    return (file_reader_t*)ctx;
+}
+
+
+file_reader_t * trreader_create(file_reader_t* inner, const char* trace_fn)
+{
+    file_reader_t *trr = 0;
+    trace_sink_t *sink;
+    uint8_t header[TRACE_HEADER_SIZE];
+    uint64_t size;
+
+    if (0 == inner)
+        return 0;
+
+    sink = (trace_sink_t*)VGM_MALLOC(sizeof(trace_sink_t));
+    if (0 == sink)
+        return 0;
+
+    sink->trace = fopen(trace_fn, "wb");
+    if (0 == sink->trace)
+    {
+        VGM_FREE(sink);
+        return 0;
+    }
+
+    size = (uint64_t)inner->size(inner);
+    memcpy(header, TRACE_MAGIC, 4);
+    put_u32(header + 4, TRACE_VERSION);
+    put_u32(header + 8, (uint32_t)size);
+    put_u32(header + 12, (uint32_t)(size >> 32));
+    if ((fwrite(header, 1, TRACE_HEADER_SIZE, sink->trace) != TRACE_HEADER_SIZE) || (0 == (trr = create(inner, sink))))
+    {
+        fclose(sink->trace);
+        VGM_FREE(sink);
+        return 0;
+    }
+    sink->refs = 1;
+    sink->records = 0;
+    vmutex_init(&sink->lock);
+
+    return trr;
+}
+
+
+file_reader_t * trreader_share(file_reader_t* inner, file_reader_t* trace_of)
+{
+    trace_sink_t *sink;
+    file_reader_t *trr;
+
+    if ((0 == inner) || (0 == trace_of))
+        return 0;
+    sink = ((trr_t *)trace_of)->sink;
+    trr = create(inner, sink);
+    if (trr)
+    {
+        vmutex_lock(&sink->lock);
+        ++sink->refs;
+        vmutex_unlock(&sink->lock);
+    }
+    return trr;
+}
+
+
+void trreader_destroy(file_reader_t *trr)
+{
+    trr_t* ctx = (trr_t*)trr;
+    trace_sink_t *sink;
+    bool last;
+    if (0 == ctx)
+        return;
+    sink = ctx->sink;
+    vmutex_lock(&sink->lock);
+    last = (0 == --sink->refs);
+    if (last)
+        flush_records(sink);
+    vmutex_unlock(&sink->lock);
+    if (last)
+    {
+        fclose(sink->trace);
+        vmutex_destroy(&sink->lock);
+        VGM_FREE(sink);
+    }
+    ctx->inner->destroy(ctx->inner);
+    VGM_FREE(ctx);
+}
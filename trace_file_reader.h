@@ -0,0 +1,36 @@
+#pragma once
+
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Trace recording reader. Forwards everything to inner reader and logs (offset, length) of
+// every read() to trace file, for replay with tracesim. Inner reader is owned and destroyed
+// together with the trace reader once creation succeeds; on failure it is left to the caller.
+//
+// Trace file format, all fields little endian:
+//   header: "VGMT", uint32 version, uint64 file size
+//   record: uint32 offset (0xffffffff = current position), uint32 length
+// Reads at the current position are logged with the offset they resolve to.
+
+#define TRACE_MAGIC         "VGMT"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   16
+#define TRACE_RECORD_SIZE   8
+
+file_reader_t * trreader_create(file_reader_t* inner, const char* trace_fn);
+
+// Another reader on the same file logging to the trace of trace_of, a trace reader. Records of
+// all readers go to one trace in the order they are made, from any thread. Inner reader
+// ownership as with trreader_create(), the trace file is closed with the last reader using it.
+file_reader_t * trreader_share(file_reader_t* inner, file_reader_t* trace_of);
+
+void trreader_destroy(file_reader_t* trr);
+
+
+#ifdef __cplusplus
+}
+#endif
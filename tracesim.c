@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "trace_file_reader.h"
+
+// Replay a read trace recorded by trace_file_reader against cache models
+// and report hit rate and bytes moved from disk for each configuration.
+
+
+#define SIM_WAYS    4
+
+
+typedef struct sim_result_s
+{
+    uint64_t hit;           // bytes served from cache
+    uint64_t miss;          // bytes which needed disk access
+    uint64_t io_calls;      // simulated fread calls
+    uint64_t io_bytes;      // bytes moved from disk
+} sim_result_t;
+
+
+typedef struct trace_s
+{
+    uint64_t file_size;
+    size_t count;
+    uint32_t *offset;
+    uint32_t *length;
+} trace_t;
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static bool load_trace(const char *fn, trace_t *tr)
+{
+    uint8_t header[TRACE_HEADER_SIZE], rec[TRACE_RECORD_SIZE];
+    size_t alloc = 0;
+    uint64_t pos = 0;
+    FILE *fd = fopen(fn, "rb");
+    if (0 == fd)
+        return false;
+    memset(tr, 0, sizeof(trace_t));
+    if ((fread(header, 1, TRACE_HEADER_SIZE, fd) != TRACE_HEADER_SIZE) || memcmp(header, TRACE_MAGIC, 4) || (get_u32(header + 4) != TRACE_VERSION))
+    {
+        fclose(fd);
+        return false;
+    }
+    tr->file_size = (uint64_t)get_u32(header + 8) | ((uint64_t)get_u32(header + 12) << 32);
+    while (fread(rec, 1, TRACE_RECORD_SIZE, fd) == TRACE_RECORD_SIZE)
+    {
+        if (tr->count == alloc)
+        {
+            uint32_t *offset, *length;
+            alloc = alloc ? alloc * 2 : 4096;
+            offset = (uint32_t *)realloc(tr->offset, alloc * sizeof(uint32_t));
+            if (offset)
+                tr->offset = offset;
+            length = (uint32_t *)realloc(tr->length, alloc * sizeof(uint32_t));
+            if (length)
+                tr->length = length;
+            if ((0 == offset) || (0 == length))
+            {
+                free(tr->offset);
+                free(tr->length);
+                fclose(fd);
+                return false;
+            }
+        }
+        // Resolve "current position" to absolute offset
+        tr->offset[tr->count] = (0xffffffff == get_u32(rec)) ? (uint32_t)pos : get_u32(rec);
+        tr->length[tr->count] = get_u32(rec + 4);
+        pos = tr->offset[tr->count] + (uint64_t)tr->length[tr->count];
+        if (pos > tr->file_size)
+            pos = tr->file_size;
+        ++tr->count;
+    }
+    fclose(fd);
+    return true;
+}
+
+
+// Simulated fread of length bytes at offset, returns bytes available in file
+static size_t disk_read(const trace_t *tr, sim_result_t *r, size_t offset, size_t length)
+{
+    size_t n = (offset < tr->file_size) ? (size_t)(tr->file_size - offset) : 0;
+    if (n > length)
+        n = length;
+    ++r->io_calls;
+    r->io_bytes += n;
+    return n;
+}
+
+
+/*
+ * Single sliding window, as the original cfr_t: a miss reads whole windows straight to the
+ * caller and reloads the window at the first byte of the remaining tail.
+ */
+typedef struct window_s
+{
+    size_t size;
+    size_t offset;
+    size_t length;
+} window_t;
+
+
+static size_t window_direct(window_t *w, const trace_t *tr, sim_result_t *r, size_t offset, size_t length)
+{
+    size_t n, total = 0;
+    while (length > w->size)
+    {
+        n = disk_read(tr, r, offset, w->size);
+        if (0 == n)
+            return total;
+        total += n;
+        offset += n;
+        length -= n;
+    }
+    if (length > 0)
+    {
+        n = disk_read(tr, r, offset, w->size);
+        if (n > 0)
+        {
+            w->offset = offset;
+            w->length = n;
+            total += (length > n) ? n : length;
+        }
+    }
+    return total;
+}
+
+
+static void window_sim(const trace_t *tr, size_t size, sim_result_t *r)
+{
+    window_t w = { size, 0, 0 };
+    size_t o_c_s, c_s, o_c_l, offset, length;
+    memset(r, 0, sizeof(sim_result_t));
+    for (size_t i = 0; i < tr->count; ++i)
+    {
+        offset = tr->offset[i];
+        length = tr->length[i];
+        if (0 == length)
+            continue;
+        if ((w.length > 0) && (offset + length > w.offset) && (offset < w.offset + w.length))
+        {
+            o_c_s = (offset > w.offset) ? 0 : (w.offset - offset);
+            c_s = offset + o_c_s - w.offset;
+            o_c_l = (length - o_c_s > w.length - c_s) ? w.length - c_s : length - o_c_s;
+            r->hit += o_c_l;
+            if (o_c_s > 0)
+                r->miss += window_direct(&w, tr, r, offset, o_c_s);
+            if (length > o_c_s + o_c_l)
+                r->miss += window_direct(&w, tr, r, offset + o_c_s + o_c_l, length - o_c_s - o_c_l);
+        }
+        else
+        {
+            r->miss += window_direct(&w, tr, r, offset, length);
+        }
+    }
+}
+
+
+/*
+ * Set-associative block cache with LRU replacement, as cached_file_reader.c
+ */
+typedef struct block_s
+{
+    size_t tag;
+    size_t length;
+    uint64_t stamp;
+} block_t;
+
+
+static void block_sim(const trace_t *tr, size_t block_size, size_t block_count, sim_result_t *r)
+{
+    size_t ways = (block_count < SIM_WAYS) ? block_count : SIM_WAYS;
+    size_t sets = block_count / ways;
+    block_t *blocks = (block_t *)calloc(sets * ways, sizeof(block_t));
+    uint64_t clock = 0;
+    size_t offset, length, tag, b_o, n, i, k;
+    block_t *set, *blk;
+
+    memset(r, 0, sizeof(sim_result_t));
+    if (0 == blocks)
+        return;
+    for (i = 0; i < sets * ways; ++i)
+        blocks[i].tag = (size_t)-1;
+
+    for (i = 0; i < tr->count; ++i)
+    {
+        offset = tr->offset[i];
+        length = tr->length[i];
+        while (length > 0)
+        {
+            tag = offset / block_size;
+            b_o = offset - tag * block_size;
+            set = blocks + (tag % sets) * ways;
+            blk = 0;
+            for (k = 0; k < ways; ++k)
+            {
+                if (set[k].tag == tag)
+                    blk = set + k;
+            }
+            if (blk)
+            {
+                blk->stamp = ++clock;
+                n = (b_o < blk->length) ? blk->length - b_o : 0;
+                if (n > length)
+                    n = length;
+                r->hit += n;
+            }
+            else if ((0 == b_o) && (length >= block_size))
+            {
+                n = disk_read(tr, r, offset, length - length % block_size);
+                r->miss += n;
+                if (n < length - length % block_size)
+                    break;
+            }
+            else
+            {
+                blk = set;
+                for (k = 1; k < ways; ++k)
+                {
+                    if (set[k].stamp < blk->stamp)
+                        blk = set + k;
+                }
+                blk->length = disk_read(tr, r, tag * block_size, block_size);
+                if (0 == blk->length)
+                {
+                    blk->tag = (size_t)-1;
+                    blk->stamp = 0;
+                    break;
+                }
+                blk->tag = tag;
+                blk->stamp = ++clock;
+                n = (b_o < blk->length) ? blk->length - b_o : 0;
+                if (n > length)
+                    n = length;
+                r->miss += n;
+            }
+            if (0 == n)
+                break;
+            offset += n;
+            length -= n;
+        }
+    }
+    free(blocks);
+}
+
+
+static void report(const char *model, size_t block_size, size_t block_count, const sim_result_t *r)
+{
+    uint64_t total = r->hit + r->miss;
+    printf("%-8s %8lu %6lu %8lu %12llu %12llu %7.2f%% %10llu %12llu\n",
+        model, (unsigned long)block_size, (unsigned long)block_count, (unsigned long)(block_size * block_count),
+        (unsigned long long)r->hit, (unsigned long long)r->miss, total ? (double)r->hit * 100.0 / (double)total : 0.0,
+        (unsigned long long)r->io_calls, (unsigned long long)r->io_bytes);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const size_t window_sizes[] = { 1024, 2048, 4096, 8192, 16384, 32768 };
+    static const size_t block_sizes[] = { 256, 512, 1024, 2048, 4096 };
+    static const size_t block_counts[] = { 4, 8, 16, 32 };
+    trace_t tr;
+    sim_result_t r;
+    size_t i, j;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: tracesim trace\n");
+        return -1;
+    }
+    if (!load_trace(argv[1], &tr))
+    {
+        fprintf(stderr, "Unable to load trace %s\n", argv[1]);
+        return -1;
+    }
+
+    printf("%lu reads, file size %llu\n", (unsigned long)tr.count, (unsigned long long)tr.file_size);
+    printf("%-8s %8s %6s %8s %12s %12s %8s %10s %12s\n", "model", "block", "count", "memory", "hit", "miss", "hit%", "io_calls", "io_bytes");
+    for (i = 0; i < sizeof(window_sizes) / sizeof(window_sizes[0]); ++i)
+    {
+        window_sim(&tr, window_sizes[i], &r);
+        report("window", window_sizes[i], 1, &r);
+    }
+    for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); ++i)
+    {
+        for (j = 0; j < sizeof(block_counts) / sizeof(block_counts[0]); ++j)
+        {
+            block_sim(&tr, block_sizes[i], block_counts[j], &r);
+            report("block", block_sizes[i], block_counts[j], &r);
+        }
+    }
+
+    free(tr.offset);
+    free(tr.length);
+    return 0;
+}
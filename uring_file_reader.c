@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "vgm_conf.h"
+#include "vgm_thread.h"
+#include "uring_file_reader.h"
+#include "reader_stats.h"
+#include "pread_full.h"
+
+
+// Buffer states, a busy buffer belongs to the kernel until its completion is reaped
+#define URR_EMPTY   0
+#define URR_BUSY    1
+#define URR_READY   2
+
+
+struct urpool_s
+{
+    int ring_fd;
+    unsigned depth;
+    unsigned batch;
+    // Submission ring
+    void* sq_ring;
+    size_t sq_ring_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_entries;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    // Completion ring
+    void* cq_ring;
+    size_t cq_ring_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    // State, protected by lock
+    vmutex_t lock;
+    vcond_t reaped;
+    unsigned queued;        // in submission ring, not yet submitted
+    unsigned inflight;      // queued or submitted, not yet reaped
+    bool reaping;           // a thread waits in io_uring_enter for completions
+};
+
+
+typedef struct urr_buffer_s
+{
+    size_t offset;          // file offset of data[0]
+    size_t length;          // valid bytes when ready
+    int state;
+    int result;
+    struct iovec iov;
+    uint8_t* data;
+} urr_buffer_t;
+
+
+// io_uring File Reader
+typedef struct urr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    urpool_t* pool;
+    int fd;
+    size_t file_size;
+    size_t block_size;
+    size_t pos;
+    urr_buffer_t buf[2];
+    reader_stats_t stats;
+} urr_t;
+
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+// Move completions to their buffers, lock held
+static void reap(urpool_t *pool)
+{
+    unsigned head = *pool->cq_head;
+    unsigned tail = __atomic_load_n(pool->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = pool->cqes + (head & *pool->cq_mask);
+        urr_buffer_t *b = (urr_buffer_t *)(uintptr_t)cqe->user_data;
+        b->result = cqe->res;
+        b->length = (cqe->res > 0) ? (size_t)cqe->res : 0;
+        b->state = URR_READY;
+        --pool->inflight;
+        ++head;
+    }
+    __atomic_store_n(pool->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+// Submit queued requests without waiting, lock held. Returns false if some are left unsubmitted
+static bool flush(urpool_t *pool)
+{
+    while (pool->queued > 0)
+    {
+        int r = sys_io_uring_enter(pool->ring_fd, pool->queued, 0, 0);
+        if (r > 0)
+            pool->queued -= (unsigned)r;
+        else if ((0 == r) || ((EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno)))
+            break;
+    }
+    return 0 == pool->queued;
+}
+
+
+// Buffer is not filled yet, or with b == 0, no request can be queued without exceeding depth
+static bool pending(urpool_t *pool, urr_buffer_t *b)
+{
+    return b ? (URR_BUSY == b->state) : (pool->inflight >= pool->depth);
+}
+
+
+// Wait until buffer is filled, or with b == 0 until a request can be queued, lock held.
+// Returns false if the ring failed
+static bool wait_buffer(urpool_t *pool, urr_buffer_t *b)
+{
+    while (pending(pool, b))
+    {
+        reap(pool);
+        if (!pending(pool, b))
+            break;
+        // Waiting in the kernel for requests it never got would never return
+        if (!flush(pool))
+            return false;
+        if (pool->reaping)
+        {
+            // Another thread waits in the kernel and reaps for everyone
+            vcond_wait(&pool->reaped, &pool->lock);
+            continue;
+        }
+        pool->reaping = true;
+        vmutex_unlock(&pool->lock);
+        int r = sys_io_uring_enter(pool->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+        int err = errno;
+        vmutex_lock(&pool->lock);
+        pool->reaping = false;
+        reap(pool);
+        vcond_broadcast(&pool->reaped);
+        if ((r < 0) && (EINTR != err) && (EAGAIN != err) && pending(pool, b))
+            return false;
+    }
+    return true;
+}
+
+
+// Queue read of block at offset into buffer, lock held. Returns false and leaves the buffer
+// failed if the ring is full of requests which cannot be submitted
+static bool queue_read(urr_t *ctx, urr_buffer_t *b, size_t offset)
+{
+    urpool_t *pool = ctx->pool;
+    unsigned tail;
+    struct io_uring_sqe *sqe;
+
+    b->offset = offset;
+    b->length = 0;
+    // Ring is sized to depth, full only when all entries wait for submission
+    if ((pool->queued >= *pool->sq_entries) && !flush(pool))
+    {
+        b->result = -EIO;
+        b->state = URR_READY;
+        return false;
+    }
+    tail = *pool->sq_tail;
+    sqe = pool->sqes + (tail & *pool->sq_mask);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    b->result = 0;
+    b->state = URR_BUSY;
+    b->iov.iov_base = b->data;
+    b->iov.iov_len = ctx->block_size;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = ctx->fd;
+    sqe->off = (uint64_t)offset;
+    sqe->addr = (uint64_t)(uintptr_t)&b->iov;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)(uintptr_t)b;
+    pool->sq_array[tail & *pool->sq_mask] = tail & *pool->sq_mask;
+    __atomic_store_n(pool->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++pool->queued;
+    ++pool->inflight;
+    ++ctx->stats.io_reads;
+    if (pool->queued >= pool->batch)
+        flush(pool);
+    return true;
+}
+
+
+static size_t urr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    urr_t *ctx = (urr_t *)self;
+    urpool_t *pool = ctx->pool;
+    size_t total = 0, temp, start, requested = length;
+    urr_buffer_t *b, *other;
+    bool waited;
+
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    start = offset;
+    if (offset >= ctx->file_size)
+        length = 0;
+    else if (length > ctx->file_size - offset)
+        length = ctx->file_size - offset;
+
+    while (length > 0)
+    {
+        // Buffer states change when completions are reaped, possibly by another reader's thread
+        vmutex_lock(&pool->lock);
+        b = 0;
+        for (int i = 0; i < 2; ++i)
+        {
+            if ((URR_EMPTY != ctx->buf[i].state) && (offset >= ctx->buf[i].offset) && (offset < ctx->buf[i].offset + ctx->block_size))
+                b = ctx->buf + i;
+        }
+        if ((0 == b) && (length >= ctx->block_size))
+        {
+            // Bulk read, bypass buffers
+            vmutex_unlock(&pool->lock);
+            temp = pread_full(ctx->fd, out, offset, length, ctx->file_size, &ctx->stats);
+            ctx->stats.cache_miss += temp;
+            total += temp;
+            offset += temp;
+            break;
+        }
+        if (0 == b)
+        {
+            // Miss, load into a buffer which is not in flight, once the ring has room for it
+            b = (URR_BUSY != ctx->buf[0].state) ? ctx->buf : ctx->buf + 1;
+            if (!wait_buffer(pool, b) || !wait_buffer(pool, 0))
+            {
+                vmutex_unlock(&pool->lock);
+                break;
+            }
+            // On failure the buffer holds nothing and an error, which ends the read below
+            queue_read(ctx, b, offset);
+        }
+        // Keep the following block queued in the other buffer
+        other = (b == ctx->buf) ? ctx->buf + 1 : ctx->buf;
+        if ((b->offset + ctx->block_size < ctx->file_size) && (URR_BUSY != other->state)
+            && ((URR_EMPTY == other->state) || (other->offset != b->offset + ctx->block_size))
+            && (pool->inflight < pool->depth) && !queue_read(ctx, other, b->offset + ctx->block_size))
+            other->state = URR_EMPTY;   // Prefetch only, retried as a miss
+        waited = (URR_BUSY == b->state);
+        if (waited)
+        {
+            uint64_t t = reader_stats_clock();
+            bool ok = wait_buffer(pool, b);
+            ctx->stats.io_ns += reader_stats_clock() - t;
+            if (!ok)
+            {
+                vmutex_unlock(&pool->lock);
+                break;
+            }
+        }
+        vmutex_unlock(&pool->lock);
+
+        if (offset >= b->offset + b->length)
+        {
+            // Read error or short read, drop buffer and retry from offset unless nothing came
+            b->state = URR_EMPTY;
+            if (b->result <= 0)
+                break;
+            continue;
+        }
+        temp = b->offset + b->length - offset;
+        if (temp > length)
+            temp = length;
+        memcpy(out, b->data + (offset - b->offset), temp);
+        ctx->stats.bytes_copied += temp;
+        if (waited)
+            ctx->stats.cache_miss += temp;
+        else
+            ctx->stats.cache_hit += temp;
+        total += temp;
+        out += temp;
+        offset += temp;
+        length -= temp;
+    }
+    ctx->pos = offset;
+    reader_stats_count_read(&ctx->stats, start, requested, total);
+    return total;
+}
+
+
+static size_t urr_size(file_reader_t *self)
+{
+    urr_t *ctx = (urr_t *)self;
+    return ctx ? ctx->file_size : 0;
+}
+
+
+static void urr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((urr_t *)self)->stats;
+}
+
+
+urpool_t * urpool_create(unsigned depth, unsigned batch)
+{
+    struct io_uring_params p;
+    urpool_t *pool = (urpool_t*)VGM_MALLOC(sizeof(urpool_t));
+    if (0 == pool)
+        return 0;
+    memset(pool, 0, sizeof(urpool_t));
+    pool->ring_fd = -1;
+    pool->sq_ring = MAP_FAILED;
+    pool->cq_ring = MAP_FAILED;
+    pool->sqes = MAP_FAILED;
+
+    do
+    {
+        uint8_t *sq, *cq;
+        if (depth < 2)
+            depth = 2;
+        memset(&p, 0, sizeof(p));
+        pool->ring_fd = sys_io_uring_setup(depth, &p);
+        if (pool->ring_fd < 0)
+            break;
+        pool->depth = depth;
+        pool->batch = (batch > 0) ? batch : 1;
+        if (pool->batch > p.sq_entries)
+            pool->batch = p.sq_entries;
+        // Completion ring holds twice the submission entries, so depth never overflows it
+        if (pool->depth > p.cq_entries)
+            pool->depth = p.cq_entries;
+
+        pool->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        pool->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            if (pool->cq_ring_size > pool->sq_ring_size)
+                pool->sq_ring_size = pool->cq_ring_size;
+            pool->cq_ring_size = pool->sq_ring_size;
+        }
+        pool->sq_ring = mmap(0, pool->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pool->ring_fd, IORING_OFF_SQ_RING);
+        if (MAP_FAILED == pool->sq_ring)
+            break;
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            pool->cq_ring = pool->sq_ring;
+        else
+        {
+            pool->cq_ring = mmap(0, pool->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pool->ring_fd, IORING_OFF_CQ_RING);
+            if (MAP_FAILED == pool->cq_ring)
+                break;
+        }
+        pool->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        pool->sqes = (struct io_uring_sqe*)mmap(0, pool->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pool->ring_fd, IORING_OFF_SQES);
+        if (MAP_FAILED == pool->sqes)
+            break;
+
+        sq = (uint8_t *)pool->sq_ring;
+        pool->sq_head = (unsigned *)(sq + p.sq_off.head);
+        pool->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        pool->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+        pool->sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+        pool->sq_array = (unsigned *)(sq + p.sq_off.array);
+        cq = (uint8_t *)pool->cq_ring;
+        pool->cq_head = (unsigned *)(cq + p.cq_off.head);
+        pool->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        pool->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+        pool->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+        vmutex_init(&pool->lock);
+        vcond_init(&pool->reaped);
+        return pool;
+    } while (0);
+
+    if (MAP_FAILED != pool->sqes)
+        munmap(pool->sqes, pool->sqes_size);
+    if ((MAP_FAILED != pool->cq_ring) && (pool->cq_ring != pool->sq_ring))
+        munmap(pool->cq_ring, pool->cq_ring_size);
+    if (MAP_FAILED != pool->sq_ring)
+        munmap(pool->sq_ring, pool->sq_ring_size);
+    if (pool->ring_fd >= 0)
+        close(pool->ring_fd);
+    VGM_FREE(pool);
+    return 0;
+}
+
+
+void urpool_destroy(urpool_t* pool)
+{
+    if (0 == pool)
+        return;
+    munmap(pool->sqes, pool->sqes_size);
+    if (pool->cq_ring != pool->sq_ring)
+        munmap(pool->cq_ring, pool->cq_ring_size);
+    munmap(pool->sq_ring, pool->sq_ring_size);
+    close(pool->ring_fd);
+    vcond_destroy(&pool->reaped);
+    vmutex_destroy(&pool->lock);
+    VGM_FREE(pool);
+}
+
+
+void urpool_submit(urpool_t* pool)
+{
+    vmutex_lock(&pool->lock);
+    flush(pool);
+    vmutex_unlock(&pool->lock);
+}
+
+
+file_reader_t * urpool_reader_create(urpool_t* pool, const char* fn, size_t block_size)
+{
+    urr_t *ctx = 0;
+    struct stat st;
+
+    if ((0 == pool) || (0 == block_size))
+        return 0;
+
+    do
+    {
+        ctx = (urr_t*)VGM_MALLOC(sizeof(urr_t));
+        if (0 == ctx)
+            break;
+        memset(ctx, 0, sizeof(urr_t));
+        ctx->pool = pool;
+        ctx->block_size = block_size;
+        ctx->fd = open(fn, O_RDONLY);
+        if (ctx->fd < 0)
+            break;
+        if ((0 != fstat(ctx->fd, &st)) || !S_ISREG(st.st_mode))
+            break;
+        ctx->file_size = (size_t)st.st_size;
+        ctx->buf[0].data = (uint8_t*)VGM_MALLOC(block_size);
+        ctx->buf[1].data = (uint8_t*)VGM_MALLOC(block_size);
+        if ((0 == ctx->buf[0].data) || (0 == ctx->buf[1].data))
+            break;
+        reader_stats_reset(&ctx->stats);
+
+        ctx->super.self = (file_reader_t*)ctx;
+        ctx->super.read = urr_read;
+        ctx->super.size = urr_size;
+        ctx->super.borrow = 0;
+        ctx->super.destroy = urpool_reader_destroy;
+        ctx->super.stats = urr_stats;
+        ctx->super.readv = 0;
+
+        return (file_reader_t*)ctx;
+    } while (0);
+
+    if (ctx)
+    {
+        if (ctx->buf[0].data) VGM_FREE(ctx->buf[0].data);
+        if (ctx->buf[1].data) VGM_FREE(ctx->buf[1].data);
+        if (ctx->fd >= 0) close(ctx->fd);
+        VGM_FREE(ctx);
+    }
+    return 0;
+}
+
+
+void urpool_reader_destroy(file_reader_t *urr)
+{
+    urr_t *ctx = (urr_t *)urr;
+    if (0 == ctx)
+        return;
+    // Buffers may still be the target of requests in flight
+    vmutex_lock(&ctx->pool->lock);
+    wait_buffer(ctx->pool, ctx->buf);
+    wait_buffer(ctx->pool, ctx->buf + 1);
+    vmutex_unlock(&ctx->pool->lock);
+    close(ctx->fd);
+    VGM_FREE(ctx->buf[0].data);
+    VGM_FREE(ctx->buf[1].data);
+    VGM_FREE(ctx);
+}
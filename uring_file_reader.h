@@ -0,0 +1,37 @@
+#pragma once
+
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// io_uring reader pool (Linux). Every reader created on a pool keeps two buffers of
+// block_size bytes, while the caller reads one the following block is queued on the pool's
+// ring. Queued refills of all readers are submitted together with one io_uring_enter() once
+// batch requests are pending, on urpool_submit(), or when any reader has to wait for data.
+// A batch renderer with many files in flight keeps the disk queue full this way.
+// Readers on one pool may be used from different threads.
+
+typedef struct urpool_s urpool_t;
+
+// depth: maximum requests in flight, 2 per reader keeps every reader prefetching
+// batch: pending refills that trigger a submit, 1 submits every refill immediately
+// Returns 0 if io_uring is not available, caller should fall back to another reader
+urpool_t * urpool_create(unsigned depth, unsigned batch);
+
+// All readers created on the pool must be destroyed before destroying it
+void urpool_destroy(urpool_t* pool);
+
+// Submit pending refills now, e.g. after one round over all decoders
+void urpool_submit(urpool_t* pool);
+
+file_reader_t * urpool_reader_create(urpool_t* pool, const char* fn, size_t block_size);
+
+void urpool_reader_destroy(file_reader_t* urr);
+
+
+#ifdef __cplusplus
+}
+#endif
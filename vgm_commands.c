@@ -0,0 +1,224 @@
+#include <string.h>
+#include "vgm_commands.h"
+
+
+#define VCMD_WAIT_NTSC  735     // 0x62, 1/60s
+#define VCMD_WAIT_PAL   882     // 0x63, 1/50s
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+
+// Absolute offset from header field relative to its own position, 0 if not set
+static size_t header_offset(const uint8_t *data, size_t field)
+{
+    uint32_t rel = get_u32(data + field);
+    return rel ? field + rel : 0;
+}
+
+
+static void set_header_offset(uint8_t *data, size_t field, size_t offset)
+{
+    put_u32(data + field, offset ? (uint32_t)(offset - field) : 0);
+}
+
+
+// Opcode length without payload, 0 for unknown
+static size_t opcode_length(uint8_t op)
+{
+    if (op >= 0x30 && op <= 0x3f) return 2;
+    if (op == 0x4f || op == 0x50) return 2;
+    if (op >= 0x40 && op <= 0x5f) return 3;
+    if (op == 0x61) return 3;
+    if (op == 0x62 || op == 0x63) return 1;
+    if (op == 0x67) return 7;
+    if (op == 0x68) return 12;
+    if (op >= 0x70 && op <= 0x8f) return 1;
+    switch (op)
+    {
+    case 0x90: case 0x91: case 0x95: return 5;
+    case 0x92: return 6;
+    case 0x93: return 11;
+    case 0x94: return 2;
+    }
+    if (op >= 0xa0 && op <= 0xbf) return 3;
+    if (op >= 0xc0 && op <= 0xdf) return 4;
+    if (op >= 0xe0) return 5;
+    return 0;
+}
+
+
+// Samples waited by a pure wait command, 0 for anything else
+static unsigned long wait_samples(const uint8_t *p)
+{
+    if (0x61 == p[0]) return (unsigned long)p[1] | ((unsigned long)p[2] << 8);
+    if (0x62 == p[0]) return VCMD_WAIT_NTSC;
+    if (0x63 == p[0]) return VCMD_WAIT_PAL;
+    if (p[0] >= 0x70 && p[0] <= 0x7f) return (unsigned long)(p[0] & 0x0f) + 1;
+    return 0;
+}
+
+
+// Bytes needed to encode a wait of samples (< 65536) with a single command
+static size_t wait_length(unsigned long samples)
+{
+    if (0 == samples) return 0;
+    if ((samples <= 16) || (VCMD_WAIT_NTSC == samples) || (VCMD_WAIT_PAL == samples)) return 1;
+    return 3;
+}
+
+
+static size_t encoded_length(unsigned long samples)
+{
+    return (samples / 0xffff) * 3 + wait_length(samples % 0xffff);
+}
+
+
+static size_t encode_wait(uint8_t *out, unsigned long samples)
+{
+    size_t len = 0;
+    while (samples > 0)
+    {
+        unsigned long w = (samples > 0xffff) ? 0xffff : samples;
+        if (w <= 16)
+            out[len++] = (uint8_t)(0x70 + w - 1);
+        else if (VCMD_WAIT_NTSC == w)
+            out[len++] = 0x62;
+        else if (VCMD_WAIT_PAL == w)
+            out[len++] = 0x63;
+        else
+        {
+            out[len++] = 0x61;
+            out[len++] = (uint8_t)w;
+            out[len++] = (uint8_t)(w >> 8);
+        }
+        samples -= w;
+    }
+    return len;
+}
+
+
+size_t vcmd_data_start(const uint8_t* data, size_t size)
+{
+    size_t start = 0x40;
+    if ((size < 0x40) || (0 != memcmp(data, "Vgm ", 4)))
+        return 0;
+    if ((get_u32(data + 0x08) >= 0x150) && (0 != get_u32(data + 0x34)))
+        start = header_offset(data, 0x34);
+    return (start < size) ? start : 0;
+}
+
+
+size_t vcmd_length(const uint8_t* p, size_t avail)
+{
+    size_t len;
+    if ((0 == avail) || (0x66 == p[0]))
+        return 0;
+    len = opcode_length(p[0]);
+    if ((0 == len) || (len > avail))
+        return 0;
+    if (0x67 == p[0])
+    {
+        // 0x67 0x66 type size32 data, bit 31 of size is a flag (e.g. 32 bit ROM sizes)
+        len += get_u32(p + 3) & 0x7fffffff;
+        if (len > avail)
+            return 0;
+    }
+    return len;
+}
+
+
+unsigned long vcmd_count(const uint8_t* data, size_t size)
+{
+    unsigned long count = 0;
+    size_t pos = vcmd_data_start(data, size);
+    size_t len;
+    if (0 == pos)
+        return 0;
+    while ((len = vcmd_length(data + pos, size - pos)) > 0)
+    {
+        ++count;
+        pos += len;
+    }
+    return count;
+}
+
+
+size_t vcmd_compact(const uint8_t* data, size_t size, uint8_t* out)
+{
+    size_t start = vcmd_data_start(data, size);
+    size_t loop, gd3, new_loop = 0;
+    size_t ip, op, len;
+    size_t run_start = 0, run_bytes = 0;    // pending wait run in input
+    unsigned long run_samples = 0;
+
+    if (0 == start)
+        return 0;
+    loop = header_offset(data, 0x1c);
+    gd3 = header_offset(data, 0x14);
+    memcpy(out, data, start);
+    ip = op = start;
+    while (1)
+    {
+        // Command at ip is only looked into once it is known to be complete
+        unsigned long w;
+        len = vcmd_length(data + ip, size - ip);
+        w = (len > 0) ? wait_samples(data + ip) : 0;
+        // Flush pending waits before the loop point and any non-wait command
+        if ((run_bytes > 0) && ((0 == w) || (ip == loop)))
+        {
+            if (encoded_length(run_samples) < run_bytes)
+                op += encode_wait(out + op, run_samples);
+            else
+            {
+                memcpy(out + op, data + run_start, run_bytes);
+                op += run_bytes;
+            }
+            run_bytes = 0;
+            run_samples = 0;
+        }
+        if (ip == loop)
+            new_loop = op;
+        if (0 == len)
+            break;
+        if (w > 0)
+        {
+            if (0 == run_bytes)
+                run_start = ip;
+            run_bytes += len;
+            run_samples += w;
+        }
+        else
+        {
+            memcpy(out + op, data + ip, len);
+            op += len;
+        }
+        ip += len;
+    }
+    // Stopped at end of data, unknown opcode or truncated command, only the first is acceptable
+    if ((ip >= size) || (0x66 != data[ip]))
+        return 0;
+    if ((loop && !new_loop) || (gd3 && (gd3 <= ip)))
+        return 0;
+    // End of data command and whatever follows (GD3) move as one block
+    memcpy(out + op, data + ip, size - ip);
+    if (gd3)
+        gd3 -= ip - op;
+    op += size - ip;
+    put_u32(out + 0x04, (uint32_t)(op - 0x04));
+    set_header_offset(out, 0x14, gd3);
+    set_header_offset(out, 0x1c, new_loop);
+    return op;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Walk VGM command data in memory without the decoder: opcode lengths, command counts and
+// compaction of wait runs. Offsets are absolute file offsets.
+
+// Offset of first command, 0 if data is not a VGM file
+size_t vcmd_data_start(const uint8_t* data, size_t size);
+
+// Length of command at p including opcode and data block payload. 0 for end of data (0x66),
+// unknown opcode or command truncated by avail
+size_t vcmd_length(const uint8_t* p, size_t avail);
+
+// Number of commands from data start to end of data, one pass, loop not followed
+unsigned long vcmd_count(const uint8_t* data, size_t size);
+
+// Copy VGM file to out (at least size bytes) merging runs of consecutive waits into the shortest
+// encoding, a run is not merged across the loop point. Header offsets (EOF, GD3, loop) are updated,
+// everything else is copied as is. Returns compacted size, 0 if data is not a well formed VGM
+size_t vcmd_compact(const uint8_t* data, size_t size, uint8_t* out);
+
+
+#ifdef __cplusplus
+}
+#endif
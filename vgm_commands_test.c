@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vgm_conf.h"
+#include "vgm_commands.h"
+
+
+// Compacts small hand made VGM files and compares against the files that should come out. Inputs
+// are copied to buffers of their exact size, so reading past the end shows up with a sanitizer
+
+#define NO_LOOP     ((size_t)-1)
+#define MAX_FILE    256
+
+
+static const uint8_t gd3[] = { 'G', 'd', '3', ' ', 0x00, 0x01, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 'a', 0, 'b', 0 };
+
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+
+// VGM 1.50 file with cmds as data, loop at cmds[loop] unless NO_LOOP, followed by end of data and
+// GD3 tag when tagged. Returns file size
+static size_t make_vgm(uint8_t *buf, const uint8_t *cmds, size_t n, size_t loop, bool tagged)
+{
+    size_t size = 0x40;
+    memset(buf, 0, 0x40);
+    memcpy(buf, "Vgm ", 4);
+    put_u32(buf + 0x08, 0x150);
+    put_u32(buf + 0x34, 0x40 - 0x34);
+    memcpy(buf + size, cmds, n);
+    size += n;
+    if (NO_LOOP != loop)
+        put_u32(buf + 0x1c, (uint32_t)(0x40 + loop - 0x1c));
+    buf[size++] = 0x66;
+    if (tagged)
+    {
+        put_u32(buf + 0x14, (uint32_t)(size - 0x14));
+        memcpy(buf + size, gd3, sizeof(gd3));
+        size += sizeof(gd3);
+    }
+    put_u32(buf + 0x04, (uint32_t)(size - 0x04));
+    return size;
+}
+
+
+static size_t compact(const uint8_t *file, size_t size, uint8_t *out)
+{
+    uint8_t *exact = (uint8_t *)malloc(size);
+    size_t n;
+    if (0 == exact)
+        return 0;
+    memcpy(exact, file, size);
+    n = vcmd_compact(exact, size, out);
+    free(exact);
+    return n;
+}
+
+
+// Compacting in (loop at in_loop) must give exactly the file made of out (loop at out_loop)
+static bool compact_test(const char *name, const uint8_t *in, size_t in_n, size_t in_loop,
+                         const uint8_t *out, size_t out_n, size_t out_loop, bool tagged)
+{
+    uint8_t src[MAX_FILE], expect[MAX_FILE], result[MAX_FILE];
+    size_t src_size = make_vgm(src, in, in_n, in_loop, tagged);
+    size_t expect_size = make_vgm(expect, out, out_n, out_loop, tagged);
+    size_t n = compact(src, src_size, result);
+    bool ok = (n == expect_size) && (0 == memcmp(result, expect, n));
+    VGM_PRINTF("%s: %s\n", name, ok ? "ok" : "failed");
+    return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+
+    {
+        // 4 x 16 samples, 2 x 16 samples in long form, merged; 3 x 16 samples take as much space as
+        // merged and stay as they are
+        const uint8_t in[] = { 0xb4, 0x00, 0x01, 0x7f, 0x7f, 0x7f, 0x7f, 0xb4, 0x01, 0x02, 0x61, 0x10, 0x00, 0x61, 0x10, 0x00,
+                               0xb4, 0x02, 0x03, 0x7f, 0x7f, 0x7f };
+        const uint8_t out[] = { 0xb4, 0x00, 0x01, 0x61, 0x40, 0x00, 0xb4, 0x01, 0x02, 0x61, 0x20, 0x00,
+                                0xb4, 0x02, 0x03, 0x7f, 0x7f, 0x7f };
+        ok &= compact_test("merge waits", in, sizeof(in), NO_LOOP, out, sizeof(out), NO_LOOP, false);
+    }
+    {
+        // Runs that merge to 1/60s and to more than 0xffff samples
+        const uint8_t in[] = { 0x61, 0x00, 0x01, 0x61, 0xdf, 0x01, 0xb4, 0x00, 0x01, 0x61, 0xff, 0xff, 0x61, 0xff, 0xff, 0x61, 0x02, 0x00 };
+        const uint8_t out[] = { 0x62, 0xb4, 0x00, 0x01, 0x61, 0xff, 0xff, 0x61, 0xff, 0xff, 0x71 };
+        ok &= compact_test("merge to short forms", in, sizeof(in), NO_LOOP, out, sizeof(out), NO_LOOP, false);
+    }
+    {
+        // Waits on both sides of the loop point are merged separately, loop offset follows
+        const uint8_t in[] = { 0xb4, 0x00, 0x01, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0xb4, 0x01, 0x02 };
+        const uint8_t out[] = { 0xb4, 0x00, 0x01, 0x61, 0x40, 0x00, 0x61, 0x40, 0x00, 0xb4, 0x01, 0x02 };
+        ok &= compact_test("split at loop point", in, sizeof(in), 7, out, sizeof(out), 6, false);
+    }
+    {
+        // GD3 tag moves with end of data, header offsets are rewritten
+        const uint8_t in[] = { 0x7f, 0x7f, 0x7f, 0x7f, 0xb4, 0x00, 0x01 };
+        const uint8_t out[] = { 0x61, 0x40, 0x00, 0xb4, 0x00, 0x01 };
+        ok &= compact_test("relocate GD3", in, sizeof(in), 4, out, sizeof(out), 3, true);
+    }
+    {
+        // Data block size has bit 31 set as a flag, the block is skipped by the masked size
+        const uint8_t in[] = { 0x67, 0x66, 0x8f, 0x02, 0x00, 0x00, 0x80, 0xaa, 0xbb, 0x7f, 0x7f, 0x7f, 0x7f, 0xb4, 0x00, 0x01 };
+        const uint8_t out[] = { 0x67, 0x66, 0x8f, 0x02, 0x00, 0x00, 0x80, 0xaa, 0xbb, 0x61, 0x40, 0x00, 0xb4, 0x00, 0x01 };
+        ok &= compact_test("data block size flag", in, sizeof(in), NO_LOOP, out, sizeof(out), NO_LOOP, false);
+    }
+    {
+        // Input cut inside or right after a command, without end of data, is not well formed
+        const uint8_t in[] = { 0x7f, 0x7f, 0xb4, 0x00, 0x01, 0x61, 0x10, 0x00 };
+        uint8_t src[MAX_FILE], result[MAX_FILE];
+        size_t size = make_vgm(src, in, sizeof(in), NO_LOOP, false) - 1;
+        bool truncated = true;
+        for (size_t cut = size; cut > 0x40; --cut)
+            truncated &= (0 == compact(src, cut, result));
+        VGM_PRINTF("truncated input: %s\n", truncated ? "ok" : "failed");
+        ok &= truncated;
+    }
+
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// Minimal thread, mutex and condition variable wrappers over Win32 / pthreads
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef _WIN32
+
+typedef HANDLE vthread_t;
+typedef CRITICAL_SECTION vmutex_t;
+typedef CONDITION_VARIABLE vcond_t;
+
+// Thread entry is declared with VTHREAD_FUNC(name, arg) and finishes with VTHREAD_RETURN
+#define VTHREAD_FUNC(name, arg) static DWORD WINAPI name(LPVOID arg)
+#define VTHREAD_RETURN return 0
+
+static inline int vthread_create(vthread_t *t, LPTHREAD_START_ROUTINE func, void *arg)
+{
+    *t = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return (NULL == *t) ? -1 : 0;
+}
+static inline void vthread_join(vthread_t t) { WaitForSingleObject(t, INFINITE); CloseHandle(t); }
+static inline void vmutex_init(vmutex_t *m) { InitializeCriticalSection(m); }
+static inline void vmutex_destroy(vmutex_t *m) { DeleteCriticalSection(m); }
+static inline void vmutex_lock(vmutex_t *m) { EnterCriticalSection(m); }
+static inline void vmutex_unlock(vmutex_t *m) { LeaveCriticalSection(m); }
+static inline void vcond_init(vcond_t *c) { InitializeConditionVariable(c); }
+static inline void vcond_destroy(vcond_t *c) { (void)c; }
+static inline void vcond_wait(vcond_t *c, vmutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static inline void vcond_signal(vcond_t *c) { WakeConditionVariable(c); }
+static inline void vcond_broadcast(vcond_t *c) { WakeAllConditionVariable(c); }
+static inline int vthread_cpu_count(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+
+#else
+
+typedef pthread_t vthread_t;
+typedef pthread_mutex_t vmutex_t;
+typedef pthread_cond_t vcond_t;
+
+#define VTHREAD_FUNC(name, arg) static void * name(void *arg)
+#define VTHREAD_RETURN return NULL
+
+static inline int vthread_create(vthread_t *t, void *(*func)(void *), void *arg)
+{
+    return (0 == pthread_create(t, NULL, func, arg)) ? 0 : -1;
+}
+static inline void vthread_join(vthread_t t) { pthread_join(t, NULL); }
+static inline void vmutex_init(vmutex_t *m) { pthread_mutex_init(m, NULL); }
+static inline void vmutex_destroy(vmutex_t *m) { pthread_mutex_destroy(m); }
+static inline void vmutex_lock(vmutex_t *m) { pthread_mutex_lock(m); }
+static inline void vmutex_unlock(vmutex_t *m) { pthread_mutex_unlock(m); }
+static inline void vcond_init(vcond_t *c) { pthread_cond_init(c, NULL); }
+static inline void vcond_destroy(vcond_t *c) { pthread_cond_destroy(c); }
+static inline void vcond_wait(vcond_t *c, vmutex_t *m) { pthread_cond_wait(c, m); }
+static inline void vcond_signal(vcond_t *c) { pthread_cond_signal(c); }
+static inline void vcond_broadcast(vcond_t *c) { pthread_cond_broadcast(c); }
+static inline int vthread_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <parg.h>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <psapi.h>
+#else
+# include <sys/resource.h>
+#endif
+
+#include "vgm_conf.h"
+#include "reader_factory.h"
+#include "memory_file_reader.h"
+#include "reader_stats.h"
+#include "vgm_commands.h"
+#include "vgm.h"
+
+// Decoder throughput benchmark, no audio device involved.
+// Each file is loaded (and un-gzipped) into memory once, so timings cover vgm_create, playback
+// setup and vgm_get_samples only.
+// Protocol: warm-up passes are decoded and discarded, then every timed pass decodes the whole
+// track from a fresh vgm_t; the median pass is reported, fastest pass is reported alongside.
+
+
+#define SAMPLE_RATE         44100
+#define BENCH_BUFFER        1024
+#define MAX_REPEAT          100
+
+
+typedef struct bench_result_s
+{
+    const char* name;
+    unsigned long samples;      // samples per pass
+    unsigned long commands;     // VGM commands per pass
+    uint64_t median_ns;
+    uint64_t min_ns;
+    uint64_t command_ns;        // decode time of files whose commands could be counted
+    size_t peak_rss_kb;         // peak of the whole process so far, never goes down
+} bench_result_t;
+
+
+static void usage()
+{
+    printf("Usage:\n");
+    printf("vgmbench [-wWarmup] [-rRepeat] [-j] file ...\n");
+    printf("Options\n");
+    printf("-w  Untimed warm-up passes per file, default 1\n");
+    printf("-r  Timed passes per file, default 5, median is reported\n");
+    printf("-j  One JSON object per line instead of table\n");
+}
+
+
+static size_t peak_rss_kb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize / 1024;
+    return 0;
+#else
+    struct rusage ru;
+    if (0 != getrusage(RUSAGE_SELF, &ru))
+        return 0;
+# ifdef __APPLE__
+    return (size_t)ru.ru_maxrss / 1024;    // bytes on macOS
+# else
+    return (size_t)ru.ru_maxrss;
+# endif
+#endif
+}
+
+
+// Load whole file decompressed
+static uint8_t * load(const char *fn, size_t *size)
+{
+    uint8_t *data = 0;
+    file_reader_t *reader = freader_open(fn, FREADER_DEFAULT_BUDGET, 0);
+    if (0 == reader)
+        return 0;
+    *size = reader->size(reader);
+    if (*size > 0)
+    {
+        data = (uint8_t *)VGM_MALLOC(*size);
+        if (data && (reader->read(reader, data, 0, *size) != *size))
+        {
+            VGM_FREE(data);
+            data = 0;
+        }
+    }
+    freader_close(reader);
+    return data;
+}
+
+
+// Decode one whole pass, returns elapsed ns or 0 on error
+static uint64_t decode_pass(const uint8_t *data, size_t size, unsigned long *samples)
+{
+    int16_t buffer[BENCH_BUFFER];
+    file_reader_t *reader = 0;
+    vgm_t *vgm = 0;
+    uint64_t t0, t = 0;
+    unsigned long done = 0;
+
+    do
+    {
+        reader = memreader_create_from_buffer(data, size, false);
+        if (0 == reader)
+            break;
+        t0 = reader_stats_clock();
+        vgm = vgm_create(reader);
+        if (0 == vgm)
+            break;
+        vgm_prepare_playback(vgm, SAMPLE_RATE, false);
+        while (done < vgm->complete_samples)
+        {
+            int n = vgm_get_samples(vgm, buffer, BENCH_BUFFER);
+            if (n <= 0)
+                break;
+            done += (unsigned long)n;
+        }
+        t = reader_stats_clock() - t0;
+        if (0 == t)
+            t = 1;
+        *samples = done;
+    } while (0);
+
+    if (vgm) vgm_destroy(vgm);
+    if (reader) memreader_destroy(reader);
+    return t;
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+static bool bench_file(const char *fn, int warmup, int repeat, bench_result_t *res)
+{
+    uint64_t ns[MAX_REPEAT];
+    size_t size;
+    uint8_t *data = load(fn, &size);
+    bool ok = true;
+
+    memset(res, 0, sizeof(bench_result_t));
+    res->name = fn;
+    if (0 == data)
+        return false;
+    res->commands = vcmd_count(data, size);
+    for (int i = 0; ok && (i < warmup); ++i)
+        ok = (0 != decode_pass(data, size, &res->samples));
+    for (int i = 0; ok && (i < repeat); ++i)
+    {
+        ns[i] = decode_pass(data, size, &res->samples);
+        ok = (0 != ns[i]);
+    }
+    VGM_FREE(data);
+    if (!ok)
+        return false;
+    qsort(ns, (size_t)repeat, sizeof(uint64_t), compare_u64);
+    res->median_ns = ns[repeat / 2];
+    res->min_ns = ns[0];
+    res->command_ns = res->commands ? res->median_ns : 0;
+    res->peak_rss_kb = peak_rss_kb();
+    return true;
+}
+
+
+// JSON string with quotes, backslashes (Windows paths) and control characters escaped
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; '\0' != *s; ++s)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (('"' == c) || ('\\' == c))
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+
+static void print_result(const bench_result_t *res, bool json)
+{
+    double sec = (double)res->median_ns / 1e9;
+    double sps = res->samples / sec;
+    double ns_sample = res->samples ? (double)res->median_ns / res->samples : 0.0;
+    double ns_command = res->commands ? (double)res->command_ns / res->commands : 0.0;
+    if (json)
+    {
+        printf("{\"file\":");
+        print_json_string(res->name);
+        printf(",\"samples\":%lu,\"commands\":%lu,\"median_ns\":%llu,\"min_ns\":%llu,"
+            "\"samples_per_sec\":%.0f,\"realtime\":%.2f,\"ns_per_sample\":%.2f,\"ns_per_command\":%.2f,\"process_peak_rss_kb\":%lu}\n",
+            res->samples, res->commands, (unsigned long long)res->median_ns, (unsigned long long)res->min_ns,
+            sps, sps / SAMPLE_RATE, ns_sample, ns_command, (unsigned long)res->peak_rss_kb);
+    }
+    else
+    {
+        printf("%-32s %12.0f %9.2fx %9.2f %9.2f %12lu\n", res->name, sps, sps / SAMPLE_RATE, ns_sample, ns_command,
+            (unsigned long)res->peak_rss_kb);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    bench_result_t res, total;
+    int warmup = 1, repeat = 5;
+    bool json = false;
+    int failed = 0;
+    const char **files;
+    int nfiles = 0;
+
+    files = (const char **)malloc(sizeof(char *) * (size_t)argc);
+    if (0 == files)
+        return -1;
+
+    // Parse command line options
+    struct parg_state ps;
+    int c;
+    parg_init(&ps);
+    while ((c = parg_getopt(&ps, argc, argv, "w:r:jh")) != -1)
+    {
+        switch (c)
+        {
+        case 1:
+            files[nfiles++] = ps.optarg;
+            break;
+        case 'w':
+            warmup = atoi(ps.optarg);
+            break;
+        case 'r':
+            repeat = atoi(ps.optarg);
+            break;
+        case 'j':
+            json = true;
+            break;
+        case 'h':
+            usage();
+            free(files);
+            return 0;
+        }
+    }
+    if (0 == nfiles)
+    {
+        usage();
+        free(files);
+        return -1;
+    }
+    if (warmup < 0) warmup = 0;
+    if (repeat < 1) repeat = 1;
+    if (repeat > MAX_REPEAT) repeat = MAX_REPEAT;
+
+    if (!json)
+        printf("%-32s %12s %10s %9s %9s %12s\n", "file", "samples/s", "realtime", "ns/smpl", "ns/cmd", "proc peak KB");
+    memset(&total, 0, sizeof(bench_result_t));
+    total.name = "total";
+    for (int i = 0; i < nfiles; ++i)
+    {
+        if (!bench_file(files[i], warmup, repeat, &res))
+        {
+            VGM_PRINTERR("Error decoding %s\n", files[i]);
+            ++failed;
+            continue;
+        }
+        print_result(&res, json);
+        total.samples += res.samples;
+        total.commands += res.commands;
+        total.median_ns += res.median_ns;
+        total.min_ns += res.min_ns;
+        total.command_ns += res.command_ns;
+    }
+    if (total.median_ns > 0)
+    {
+        total.peak_rss_kb = peak_rss_kb();
+        print_result(&total, json);
+    }
+    free(files);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pack_file_reader.h"
+#include "reader_factory.h"
+#include "vgm_commands.h"
+
+// Build a pack file from a list of files, or list members of an existing pack.
+// Members are named by the path given on command line, with '\' converted to '/'.
+// Members are read through the reader factory, so .vgz input is always stored inflated.
+// With -c members are stored ready to play: runs of waits are merged as well.
+// Members are streamed to the pack one at a time, the index is written last.
+
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+
+// Open member, gzip input is inflated by the vgz reader
+static file_reader_t * open_member(const char *fn)
+{
+    file_reader_t *reader = freader_open(fn, FREADER_DEFAULT_BUDGET, 0);
+#ifndef VGM_HAVE_ZLIB
+    // No vgz reader to probe with, gzip data would be stored as is
+    uint8_t magic[2];
+    if (reader && (reader->read(reader, magic, 0, 2) == 2) && (0x1f == magic[0]) && (0x8b == magic[1]))
+    {
+        fprintf(stderr, "%s is compressed, vgmpack is built without zlib\n", fn);
+        freader_close(reader);
+        return 0;
+    }
+#endif
+    return reader;
+}
+
+
+// Member loaded whole with wait runs merged, files which are not VGM are kept as they are
+static bool write_compiled(FILE *out, file_reader_t *reader, size_t *size)
+{
+    uint8_t *data = (uint8_t *)malloc(*size ? *size : 1);
+    uint8_t *compact = (uint8_t *)malloc(*size ? *size : 1);
+    bool ok = false;
+    size_t n;
+    if (data && compact && (reader->read(reader, data, 0, *size) == *size))
+    {
+        n = vcmd_compact(data, *size, compact);
+        if (n > 0)
+            *size = n;
+        ok = fwrite((n > 0) ? compact : data, 1, *size, out) == *size;
+    }
+    free(compact);
+    free(data);
+    return ok;
+}
+
+
+static bool write_copy(FILE *out, file_reader_t *reader, size_t size)
+{
+    uint8_t buf[16384];
+    size_t done = 0, n;
+    while (done < size)
+    {
+        n = reader->read(reader, buf, done, (size - done > sizeof(buf)) ? sizeof(buf) : size - done);
+        if ((0 == n) || (fwrite(buf, 1, n, out) != n))
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+
+// Write member at current position of out, one member is in memory at a time at most.
+// Returns bytes written, -1 on failure
+static long write_member(FILE *out, const char *fn, bool compile)
+{
+    file_reader_t *reader = open_member(fn);
+    size_t size;
+    bool ok;
+    if (0 == reader)
+        return -1;
+    size = reader->size(reader);
+    ok = compile ? write_compiled(out, reader, &size) : write_copy(out, reader, size);
+    freader_close(reader);
+    return ok ? (long)size : -1;
+}
+
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+
+// Member names as stored, '\' converted to '/'. NULL if a name is too long or used twice
+static char ** member_names(int count, char *files[], size_t *index_size)
+{
+    char **names = (char **)calloc((size_t)count, sizeof(char *));
+    char **sorted = (char **)malloc(sizeof(char *) * (size_t)count);
+    bool ok = (0 != names) && (0 != sorted);
+    int i;
+    *index_size = 0;
+    for (i = 0; ok && (i < count); ++i)
+    {
+        size_t len = strlen(files[i]);
+        if (len > 0xffff)
+        {
+            fprintf(stderr, "Name too long %s\n", files[i]);
+            ok = false;
+            break;
+        }
+        names[i] = (char *)malloc(len + 1);
+        if (0 == names[i])
+        {
+            ok = false;
+            break;
+        }
+        for (size_t j = 0; j <= len; ++j)
+            names[i][j] = ('\\' == files[i][j]) ? '/' : files[i][j];
+        sorted[i] = names[i];
+        *index_size += VPACK_ENTRY_SIZE + len;
+    }
+    if (ok)
+    {
+        // Pack reader serves the first match, a second member of the same name would be unreachable
+        qsort(sorted, (size_t)count, sizeof(char *), by_name);
+        for (i = 1; i < count; ++i)
+        {
+            if (0 == strcmp(sorted[i - 1], sorted[i]))
+            {
+                fprintf(stderr, "Member %s given twice\n", sorted[i]);
+                ok = false;
+                break;
+            }
+        }
+    }
+    free(sorted);
+    if (!ok && names)
+    {
+        for (i = 0; i < count; ++i)
+            free(names[i]);
+        free(names);
+        names = 0;
+    }
+    return names;
+}
+
+
+static int create_pack(const char *pack_fn, int count, char *files[], bool compile)
+{
+    static const uint8_t zero[VPACK_ALIGN] = { 0 };
+    uint8_t header[VPACK_HEADER_SIZE];
+    uint8_t *index = 0;
+    char **names;
+    size_t index_size, pos;
+    FILE *out = 0;
+    int i, ret = -1;
+
+    names = member_names(count, files, &index_size);
+    if (0 == names)
+        return -1;
+    memcpy(header, VPACK_MAGIC, 4);
+    put_u32(header + 4, VPACK_VERSION);
+    put_u32(header + 8, (uint32_t)count);
+    put_u32(header + 12, (uint32_t)index_size);
+
+    do
+    {
+        long written, length;
+        index = (uint8_t *)malloc(index_size ? index_size : 1);
+        if (0 == index)
+            break;
+        out = fopen(pack_fn, "wb");
+        if (0 == out)
+        {
+            fprintf(stderr, "Unable to create %s\n", pack_fn);
+            break;
+        }
+        // Members are written as they are read, index goes in front once their sizes are known
+        written = VPACK_HEADER_SIZE + (long)index_size;
+        if (0 != fseek(out, written, SEEK_SET))
+            break;
+        for (i = 0, pos = 0; i < count; ++i)
+        {
+            size_t name_len = strlen(names[i]);
+            size_t pad = (size_t)(-written & (VPACK_ALIGN - 1));
+            if (fwrite(zero, 1, pad, out) != pad)
+                break;
+            written += (long)pad;
+            length = write_member(out, files[i], compile);
+            if (length < 0)
+            {
+                fprintf(stderr, "Unable to copy %s\n", files[i]);
+                break;
+            }
+            put_u64(index + pos, (uint64_t)written);
+            put_u64(index + pos + 8, (uint64_t)length);
+            put_u16(index + pos + 16, (uint16_t)name_len);
+            memcpy(index + pos + VPACK_ENTRY_SIZE, names[i], name_len);
+            pos += VPACK_ENTRY_SIZE + name_len;
+            written += length;
+        }
+        if (i < count)
+            break;
+        if ((0 != fseek(out, 0, SEEK_SET)) || (fwrite(header, 1, VPACK_HEADER_SIZE, out) != VPACK_HEADER_SIZE)
+            || (fwrite(index, 1, index_size, out) != index_size))
+            break;
+        ret = 0;
+    } while (0);
+
+    if (out)
+    {
+        if (0 != fclose(out))
+            ret = -1;
+        if (ret != 0)
+            remove(pack_fn);
+    }
+    for (i = 0; i < count; ++i)
+        free(names[i]);
+    free(names);
+    free(index);
+    return ret;
+}
+
+
+static int list_pack(const char *pack_fn)
+{
+    vpack_t *pack = vpack_open(pack_fn);
+    if (0 == pack)
+    {
+        fprintf(stderr, "Unable to open pack %s\n", pack_fn);
+        return -1;
+    }
+    for (unsigned i = 0; i < vpack_count(pack); ++i)
+    {
+        const char *name = vpack_name(pack, i);
+        file_reader_t *member = vpack_reader_create(pack, name);
+        printf("%10lu  %s\n", member ? (unsigned long)member->size(member) : 0ul, name);
+        if (member)
+            vpack_reader_destroy(member);
+    }
+    vpack_close(pack);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool compile = (argc > 1) && (0 == strcmp(argv[1], "-c"));
+    if (compile)
+    {
+        --argc;
+        ++argv;
+    }
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: vgmpack [-c] pack.vpk [file ...]\n");
+        fprintf(stderr, "       Without files, list members of pack.vpk\n");
+        fprintf(stderr, "       .vgz files are stored inflated\n");
+        fprintf(stderr, "       -c  store members ready to play: merge waits\n");
+        return -1;
+    }
+    if (2 == argc)
+        return list_pack(argv[1]);
+    return create_pack(argv[1], argc - 2, argv + 2, compile);
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <parg.h>
 #include <cwalk.h>
@@ -16,14 +17,28 @@
 
 #include "ansicon.h"
 #include "vgm_conf.h"
-#include "cached_file_reader.h"
+#include "reader_factory.h"
+#include "trace_file_reader.h"
+#include "pack_file_reader.h"
+#include "wav_writer.h"
+#include "sample_convert.h"
+#include "loop_cache.h"
 #include "vgm.h"
 
 
 #define SDL_BUFFER_SIZE 2048
-#define READER_CACHE_SIZE 4096
-#define SAMPLE_RATE 44100
+#define READER_MEMORY_BUDGET (4 * 1024 * 1024)
+#define SAMPLE_RATE 44100          // default output rate
 #define MAX_PATH_NAME 256
+#define SEEK_SECONDS 10
+#define LOOP_CACHE_BUDGET (16 * 1024 * 1024)
+
+typedef enum
+{
+    DUMP_S16,
+    DUMP_S32,
+    DUMP_F32
+} dump_format_t;
 
 typedef struct vgmplay_ctrl_s
 {
@@ -32,7 +47,22 @@ typedef struct vgmplay_ctrl_s
     bool enable_apu_triangle;
     bool enable_apu_noise;
     bool enable_apu_dmc;
-    unsigned long complete_samples;
+    bool keyboard;          // false when stdin carries the vgm data
+    bool use_loop_cache;    // replay loop body from memory once it repeats
+    dump_format_t dump_format;
+    unsigned sample_rate;   // output rate, decoder synthesizes at this rate
+    unsigned long complete_samples; // at sample_rate
+    const char *vgm_file;
+    vpack_t *pack;          // vgm_file is a member of pack if not NULL
+    file_reader_t *trace;   // reader of main decoder when reads are traced, NULL otherwise
+    // Player state, shared with audio callback
+    vgm_t *vgm;
+    loop_cache_t *loop_cache;
+    unsigned device_channels;
+    unsigned long played_samples;
+    // Decoder swapped in by last seek and its reader, owned by player
+    vgm_t *seek_vgm;
+    file_reader_t *seek_reader;
 } vgmplay_ctrl_t;
 
 
@@ -40,15 +70,34 @@ typedef struct vgmplay_ctrl_s
 static void usage()
 {
     ansicon_puts(ANSI_GREEN, "Usage:\n");
-    ansicon_puts(ANSI_GREEN, "vgmplay [-d] [-cChannels] file.vgm\n");
+    ansicon_puts(ANSI_GREEN, "vgmplay [-d [-fFormat]] [-l] [-rRate] [-cChannels] [-tTrace] [-pPack] file.vgm|-\n");
+    ansicon_puts(ANSI_GREEN, "Use - to read uncompressed vgm data from stdin\n");
     ansicon_puts(ANSI_GREEN, "Options\n");
     ansicon_puts(ANSI_GREEN, "-d  Save output to .wav file\n");
+    ansicon_puts(ANSI_GREEN, "-f  With -d, sample format s16 (default), s32 or f32. s32 and f32 are widened 16 bit data\n");
+    ansicon_puts(ANSI_GREEN, "-t  Record file reads to trace file (see tracesim)\n");
+    ansicon_puts(ANSI_GREEN, "-p  Play file.vgm from pack file (see vgmpack)\n");
+    ansicon_puts(ANSI_GREEN, "-l  Cache loop body, later loops are played from memory\n");
+    ansicon_puts(ANSI_GREEN, "-r  Output sample rate, default 44100. Playback uses the rate of audio device\n");
     ansicon_puts(ANSI_GREEN, "-c  Enable selection of channels:\n");
     ansicon_puts(ANSI_GREEN, "    Channels for NESAPU: DNT21\n");
+    ansicon_puts(ANSI_GREEN, "Keys: 1 2 T N D toggle channel, Space pause, < > seek 10s, Q quit\n");
+}
+
+
+static int get_samples(vgmplay_ctrl_t *ctrl, int16_t *buffer, unsigned int samples)
+{
+    if (ctrl->loop_cache)
+        return loop_cache_get_samples(ctrl->loop_cache, buffer, samples);
+    return vgm_get_samples(ctrl->vgm, buffer, samples);
 }
 
+// VGM header counts samples at 44100Hz
+static unsigned long output_samples(unsigned long samples, unsigned sample_rate)
+{
+    return (unsigned long)((uint64_t)samples * sample_rate / VGM_SAMPLE_RATE);
+}
 
-static unsigned long played_samples = 0;
 
 static void show_progress(vgmplay_ctrl_t *ctrl, bool newline)
 {
@@ -81,10 +130,10 @@ static void show_progress(vgmplay_ctrl_t *ctrl, bool newline)
     strcat(progress, "  Progress: ");
     
     strcat(progress, ANSI_YELLOW);
-    percent = (int)(played_samples * 100.0f / ctrl->complete_samples);
-    t = (float)played_samples / SAMPLE_RATE;
+    percent = (int)(ctrl->played_samples * 100.0f / ctrl->complete_samples);
+    t = (float)ctrl->played_samples / ctrl->sample_rate;
     save = (int)strlen(progress);
-    snprintf(progress + save, 256 - save, "%d%% (%lu/%d:%02d.%03ds)", percent, played_samples, (int)t / 60, (int)t % 60, (int)((t - (int)t) * 1000));
+    snprintf(progress + save, 256 - save, "%d%% (%lu/%d:%02d.%03ds)", percent, ctrl->played_samples, (int)t / 60, (int)t % 60, (int)((t - (int)t) * 1000));
     if (newline)
     {
         ansicon_puts(ANSI_YELLOW, progress);
@@ -97,28 +146,117 @@ static void show_progress(vgmplay_ctrl_t *ctrl, bool newline)
 }
 
 
+// Decoder renders straight into device buffer, mono is spread to device channels in place
 static void sdl_audio_callback(void* user, Uint8* stream, int len)
 {
-    static int16_t buffer[SDL_BUFFER_SIZE];
-    unsigned int requested = (unsigned int)(len / 2); // len is in byte, each sample is 2 bytes
-    if (requested > 0)
+    vgmplay_ctrl_t *ctrl = (vgmplay_ctrl_t *)user;
+    int16_t *out = (int16_t *)stream;
+    unsigned int channels = ctrl->device_channels;
+    unsigned int frames = (unsigned int)len / (2 * channels);  // 16 bit samples
+    int samples = 0;
+    if (frames > 0)
     {
-        int samples = vgm_get_samples((vgm_t*)user, buffer, requested);
-        if (samples == requested)   // all sampels are received
-        {
-            SDL_memcpy(stream, (void *)buffer, (size_t)len);
-        }
-        else if (samples > 0)     // not all samples are received
+        samples = get_samples(ctrl, out, frames);
+        if (samples < 0)
+            samples = 0;
+        if (channels > 1)
         {
-            SDL_memset(stream, 0, (size_t)len);
-            SDL_memcpy(stream, (void *)buffer, (size_t)(samples * 2));
-        }
-        else
-        {
-            SDL_memset(stream, 0, (size_t)len); // return silent
+            // Back to front, frame i is read before anything at or after it is written
+            for (int i = samples - 1; i >= 0; --i)
+            {
+                int16_t v = out[i];
+                for (unsigned int c = 0; c < channels; ++c)
+                    out[(unsigned int)i * channels + c] = v;
+            }
         }
-        played_samples += samples;
+        ctrl->played_samples += (unsigned long)samples;
+    }
+    // Silence after end of track
+    SDL_memset(out + (unsigned int)samples * channels, 0, (size_t)len - (size_t)samples * channels * 2);
+}
+
+
+static void start_playback(vgm_t *vgm, vgmplay_ctrl_t *ctrl, bool loop)
+{
+    vgm_prepare_playback(vgm, ctrl->sample_rate, loop);
+    vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_ALL, false);
+    vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE1, ctrl->enable_apu_pulse1);
+    vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE2, ctrl->enable_apu_pulse2);
+    vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_TRIANGLE, ctrl->enable_apu_triangle);
+    vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_NOISE, ctrl->enable_apu_noise);
+    vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_DMC, ctrl->enable_apu_dmc);
+}
+
+
+// Open a reader on the track, small file is preloaded, large file is read ahead on worker
+// thread, either way audio callback does not wait for disk. Pack members are served from the
+// pack mapping. When tracing, reads are logged to the trace of the main decoder
+static file_reader_t * open_track(const vgmplay_ctrl_t *ctrl)
+{
+    file_reader_t *reader, *tracer;
+    if (ctrl->pack)
+        reader = vpack_reader_create(ctrl->pack, ctrl->vgm_file);
+    else
+        reader = freader_open(ctrl->vgm_file, READER_MEMORY_BUDGET, FREADER_STREAM);
+    if ((0 == reader) || (0 == ctrl->trace))
+        return reader;
+    tracer = trreader_share(reader, ctrl->trace);
+    if (0 == tracer)
+        freader_close(reader);
+    return tracer;
+}
+
+
+// Move playback by delta samples. Decoder only runs forward and its state can not be copied,
+// so a second decoder is run from the beginning to the target here while the playing one keeps
+// feeding the audio callback, then the two are swapped under the audio lock.
+static void seek(vgmplay_ctrl_t *ctrl, SDL_AudioDeviceID audio_id, long delta)
+{
+    int16_t buffer[SDL_BUFFER_SIZE];
+    file_reader_t *reader, *old_reader;
+    vgm_t *vgm, *old_vgm;
+    unsigned long target, done = 0;
+
+    SDL_LockAudioDevice(audio_id);
+    target = ctrl->played_samples;
+    SDL_UnlockAudioDevice(audio_id);
+    if (delta < 0)
+        target = (target > (unsigned long)(-delta)) ? target - (unsigned long)(-delta) : 0;
+    else
+        target += (unsigned long)delta;
+    if (target > ctrl->complete_samples)
+        target = ctrl->complete_samples;
+
+    reader = open_track(ctrl);
+    vgm = reader ? vgm_create(reader) : 0;
+    if (0 == vgm)
+    {
+        freader_close(reader);
+        return;
     }
+    start_playback(vgm, ctrl, true);
+    while (done < target)
+    {
+        unsigned long n = target - done;
+        int samples = vgm_get_samples(vgm, buffer, (n > SDL_BUFFER_SIZE) ? SDL_BUFFER_SIZE : (unsigned int)n);
+        if (samples <= 0)
+            break;
+        done += (unsigned long)samples;
+    }
+
+    SDL_LockAudioDevice(audio_id);
+    old_vgm = ctrl->seek_vgm;
+    old_reader = ctrl->seek_reader;
+    ctrl->vgm = vgm;
+    ctrl->seek_vgm = vgm;
+    ctrl->seek_reader = reader;
+    ctrl->played_samples = done;
+    if (ctrl->loop_cache)
+        loop_cache_seek(ctrl->loop_cache, vgm, done);
+    SDL_UnlockAudioDevice(audio_id);
+    // Decoder of an earlier seek, the one opened by main stays with main
+    if (old_vgm) vgm_destroy(old_vgm);
+    freader_close(old_reader);
 }
 
 
@@ -139,37 +277,42 @@ static int play(vgm_t *vgm, file_reader_t *reader, vgmplay_ctrl_t *ctrl)
         }
         SDL_AudioSpec want, have;
         SDL_zero(want);
-        want.freq = SAMPLE_RATE;
+        want.freq = (int)ctrl->sample_rate;
         want.format = AUDIO_S16LSB;
         want.channels = 1;
         want.samples = SDL_BUFFER_SIZE;
         want.callback = sdl_audio_callback;
-        want.userdata = (void*)vgm;
-        audio_id = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+        want.userdata = (void*)ctrl;
+        // Take device rate and channel count as is, decoder synthesizes at device rate and mono is
+        // spread to channels in callback, SDL does not convert our output
+        audio_id = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
         if (0 == audio_id)
         {
             r = -1;
             ansicon_printf(ANSI_RED, "Open audio device failed: %s\n", SDL_GetError());
             break;
         }
+        if ((unsigned)have.freq != ctrl->sample_rate)
+        {
+            ansicon_printf(ANSI_LIGHTBLUE, "Device rate:   %dHz\n", have.freq);
+            ctrl->sample_rate = (unsigned)have.freq;
+            ctrl->complete_samples = output_samples(vgm->complete_samples, ctrl->sample_rate);
+        }
+        ctrl->device_channels = have.channels;
         // start play
-        vgm_prepare_playback(vgm, SAMPLE_RATE, true);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_ALL, false);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE1, ctrl->enable_apu_pulse1);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE2, ctrl->enable_apu_pulse2);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_TRIANGLE, ctrl->enable_apu_triangle);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_NOISE, ctrl->enable_apu_noise);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_DMC, ctrl->enable_apu_dmc);
+        start_playback(vgm, ctrl, true);
+        if (ctrl->use_loop_cache)
+            ctrl->loop_cache = loop_cache_create(vgm, ctrl->sample_rate, LOOP_CACHE_BUDGET);
         SDL_PauseAudioDevice(audio_id, 0);  // unpause
         // Play loop
         while (1)
         {
             SDL_Delay(100);
-            if (played_samples >= ctrl->complete_samples)
+            if (ctrl->played_samples >= ctrl->complete_samples)
             {
                 break;
             }
-            int ch = ansicon_getch_non_blocking();
+            int ch = ctrl->keyboard ? ansicon_getch_non_blocking() : 0;
             if (('q' == ch) || ('Q' == ch))
             {
                 break;
@@ -177,62 +320,97 @@ static int play(vgm_t *vgm, file_reader_t *reader, vgmplay_ctrl_t *ctrl)
             else if ('1' == ch)
             {
                 ctrl->enable_apu_pulse1 = !ctrl->enable_apu_pulse1;
-                vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE1, ctrl->enable_apu_pulse1);
+                vgm_nesapu_enable_channel(ctrl->vgm, VGM_NESAPU_CHANNEL_PULSE1, ctrl->enable_apu_pulse1);
             }
             else if ('2' == ch)
             {
                 ctrl->enable_apu_pulse2 = !ctrl->enable_apu_pulse2;
-                vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE2, ctrl->enable_apu_pulse2);
+                vgm_nesapu_enable_channel(ctrl->vgm, VGM_NESAPU_CHANNEL_PULSE2, ctrl->enable_apu_pulse2);
             }
             else if (('t' == ch) || ('T' == ch))
             {
                 ctrl->enable_apu_triangle = !ctrl->enable_apu_triangle;
-                vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_TRIANGLE, ctrl->enable_apu_triangle);
+                vgm_nesapu_enable_channel(ctrl->vgm, VGM_NESAPU_CHANNEL_TRIANGLE, ctrl->enable_apu_triangle);
             }
             else if (('n' == ch) || ('N') == ch)
             {
                 ctrl->enable_apu_noise = !ctrl->enable_apu_noise;
-                vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_NOISE, ctrl->enable_apu_noise);
+                vgm_nesapu_enable_channel(ctrl->vgm, VGM_NESAPU_CHANNEL_NOISE, ctrl->enable_apu_noise);
             }
             else if (('d' == ch) || ('D') == ch)
             {
                 ctrl->enable_apu_dmc = !ctrl->enable_apu_dmc;
-                vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_DMC, ctrl->enable_apu_dmc);
+                vgm_nesapu_enable_channel(ctrl->vgm, VGM_NESAPU_CHANNEL_DMC, ctrl->enable_apu_dmc);
             }
             else if (' ' == ch)
             {
                 paused = !paused;
                 SDL_PauseAudioDevice(audio_id, paused ? 1 : 0);
             }
+            else if ((',' == ch) || ('<' == ch) || ('.' == ch) || ('>' == ch))
+            {
+                seek(ctrl, audio_id, (((',' == ch) || ('<' == ch)) ? -SEEK_SECONDS : SEEK_SECONDS) * (long)ctrl->sample_rate);
+            }
+            if (ctrl->loop_cache && (0 != ch) && strchr("12TtNnDd", ch))
+            {
+                // Decoder output changed, cached loop body is stale
+                SDL_LockAudioDevice(audio_id);
+                loop_cache_invalidate(ctrl->loop_cache);
+                SDL_UnlockAudioDevice(audio_id);
+            }
             show_progress(ctrl, false);
         }
         show_progress(ctrl, true);
     } while (0);
     if (audio_id != 0) SDL_CloseAudioDevice(audio_id);
+    loop_cache_destroy(ctrl->loop_cache);
+    ctrl->loop_cache = NULL;
+    if (ctrl->seek_vgm) vgm_destroy(ctrl->seek_vgm);
+    freader_close(ctrl->seek_reader);
+    ctrl->vgm = vgm;
+    ctrl->seek_vgm = NULL;
+    ctrl->seek_reader = NULL;
     SDL_Quit();
     return r;
 }
 
 
-/*
-The header of a wav file Based on: https://docs.fileformat.com/audio/wav/
-*/
-typedef struct wavfile_header_s
+static unsigned dump_wav_format(dump_format_t format)
 {
-    char    chunk_id[4];            // 1-4      "RIFF"
-    int32_t chunk_size;             // 5-8      chunk size (header_size - 8 + data_size)
-    char    format[4];              // 9-12     "WAVE"
-    char    subchunk1_id[4];        // 13-16    format chunk marker "fmt "
-    int32_t subchunk1_size;         // 17-20    chunk1 size (bytes 21-36, 16)
-    int16_t audio_format;           // 21-22    type of format (PCM is 1)
-    int16_t channels;               // 23-24    channels
-    int32_t sample_rate;            // 25-28    sample rate
-    int32_t byte_rate;              // 29-32    sample_rate * bits_per_sample * channels / 8
-    int16_t block_align;            // 33-34    bits_per_sample * channels / 8
-    int16_t bits_per_sample;        // 35-36    bits per sample
-    char    subchunk2_id[4];        // 37-40    data chunk header mark
-    int32_t subchunk2_size;         // 41-44    data chunck size
-} wavfile_header_t;
+    return (DUMP_F32 == format) ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM;
+}
+
+
+static unsigned dump_bits(dump_format_t format)
+{
+    return (DUMP_S16 == format) ? 16 : 32;
+}
+
+
+// Write decoder output in dump format
+static bool write_samples(FILE *fd, const int16_t *buffer, size_t n, dump_format_t format)
+{
+    union
+    {
+        float f32[1024];
+        int32_t s32[1024];
+    } wide;
+    if (DUMP_S16 == format)
+        return fwrite(buffer, sizeof(int16_t), n, fd) == n;
+    while (n > 0)
+    {
+        size_t chunk = (n > 1024) ? 1024 : n;
+        if (DUMP_F32 == format)
+            sample_s16_to_f32(buffer, wide.f32, chunk);
+        else
+            sample_s16_to_s32(buffer, wide.s32, chunk);
+        if (fwrite(&wide, sizeof(int32_t), chunk, fd) != chunk)
+            return false;
+        buffer += chunk;
+        n -= chunk;
+    }
+    return true;
+}
 
 
 static int dump(vgm_t *vgm, file_reader_t *reader, vgmplay_ctrl_t *ctrl, const char *out)
@@ -240,7 +418,6 @@ static int dump(vgm_t *vgm, file_reader_t *reader, vgmplay_ctrl_t *ctrl, const c
     int r = 0;
     FILE *fd = NULL;
     int16_t buffer[1024];
-    wavfile_header_t header;
     int nsamples;
     do
     {
@@ -251,48 +428,43 @@ static int dump(vgm_t *vgm, file_reader_t *reader, vgmplay_ctrl_t *ctrl, const c
             ansicon_printf(ANSI_RED, "Unable to write to %s\n", out);
             break;
         }
-        header.chunk_id[0] = 'R'; header.chunk_id[1] = 'I'; header.chunk_id[2] = 'F'; header.chunk_id[3] = 'F';
-        header.chunk_size = vgm->complete_samples * 2 + 32;
-        header.format[0] = 'W'; header.format[1] = 'A'; header.format[2] = 'V'; header.format[3] = 'E';
-        header.subchunk1_id[0] = 'f'; header.subchunk1_id[1] = 'm'; header.subchunk1_id[2] = 't'; header.subchunk1_id[3] = ' ';
-        header.subchunk1_size = 16;
-        header.audio_format = 1;
-        header.channels = 1;
-        header.sample_rate = VGM_SAMPLE_RATE;
-        header.byte_rate = 2 * VGM_SAMPLE_RATE;
-        header.block_align = 2;
-        header.bits_per_sample = 16;
-        header.subchunk2_id[0] = 'd'; header.subchunk2_id[1] = 'a'; header.subchunk2_id[2] = 't'; header.subchunk2_id[3] = 'a';
-        header.subchunk2_size = vgm->complete_samples * 2;
-        fwrite(&header, sizeof(wavfile_header_t), 1, fd);
-
-        vgm_prepare_playback(vgm, SAMPLE_RATE, false);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_ALL, false);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE1, ctrl->enable_apu_pulse1);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE2, ctrl->enable_apu_pulse2);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_TRIANGLE, ctrl->enable_apu_triangle);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_NOISE, ctrl->enable_apu_noise);
-        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_DMC, ctrl->enable_apu_dmc);
-        played_samples = 0;
-        while (played_samples < ctrl->complete_samples)
+        if (!wav_write_header(fd, dump_wav_format(ctrl->dump_format), ctrl->sample_rate, 1, dump_bits(ctrl->dump_format), ctrl->complete_samples))
+        {
+            r = -1;
+            ansicon_printf(ANSI_RED, "Unable to write to %s\n", out);
+            break;
+        }
+
+        start_playback(vgm, ctrl, false);
+        ctrl->played_samples = 0;
+        while (ctrl->played_samples < ctrl->complete_samples)
         {
             nsamples = vgm_get_samples(vgm, buffer, 1024);
-            if (nsamples > 0)
-                fwrite(buffer, sizeof(int16_t), (size_t)nsamples, fd);
-            else
+            if (nsamples <= 0)
+                break;
+            if (!write_samples(fd, buffer, (size_t)nsamples, ctrl->dump_format))
+            {
+                ansicon_printf(ANSI_RED, "\nUnable to write to %s\n", out);
                 break;
-            played_samples += nsamples;
-            if (played_samples % 4096 == 0)
+            }
+            ctrl->played_samples += nsamples;
+            if (ctrl->played_samples % 4096 == 0)
                 show_progress(ctrl, false);
         }
         show_progress(ctrl, true);
-        if (played_samples != ctrl->complete_samples)
+        if (ctrl->played_samples != ctrl->complete_samples)
         {
+            // Keep what was rendered playable
+            wav_update_header(fd, dump_wav_format(ctrl->dump_format), ctrl->sample_rate, 1, dump_bits(ctrl->dump_format), ctrl->played_samples);
             r = -1;
             break;
         }
     } while (0);
-    if (fd) fclose(fd);
+    if (fd && (0 != fclose(fd)))
+    {
+        r = -1;
+        ansicon_printf(ANSI_RED, "Unable to write to %s\n", out);
+    }
     return r;
 }
 
@@ -300,7 +472,9 @@ static int dump(vgm_t *vgm, file_reader_t *reader, vgmplay_ctrl_t *ctrl, const c
 int main(int argc, char *argv[])
 {
     file_reader_t *reader = 0;
+    vpack_t *pack = 0;
     vgm_t *vgm = 0;
+    int r = 0;
     
     ansicon_setup();
     ansicon_hide_cursor();
@@ -309,14 +483,19 @@ int main(int argc, char *argv[])
     {
         const char *vgm_file = NULL;
         bool dump_mode = false;
+        bool cache_loop = false;
+        int sample_rate = SAMPLE_RATE;
+        const char *format = "s16";
         const char *channels = "DNT21";
+        const char *trace_file = NULL;
+        const char *pack_file = NULL;
         vgmplay_ctrl_t ctrl;
 
         // Parse command line options
         struct parg_state ps;
         int c;
         parg_init(&ps);
-        while ((c = parg_getopt(&ps, argc, argv, "dc:h")) != -1)
+        while ((c = parg_getopt(&ps, argc, argv, "dlr:f:c:t:p:h")) != -1)
         {
             switch (c)
             {
@@ -328,9 +507,24 @@ int main(int argc, char *argv[])
             case 'd':
                 dump_mode = true;
                 break;
+            case 'l':
+                cache_loop = true;
+                break;
+            case 'r':
+                sample_rate = atoi(ps.optarg);
+                break;
+            case 'f':
+                format = ps.optarg;
+                break;
             case 'c':
                 channels = ps.optarg;
                 break;
+            case 't':
+                trace_file = ps.optarg;
+                break;
+            case 'p':
+                pack_file = ps.optarg;
+                break;
             }
         }
         if ((NULL == vgm_file) || ('\0' == vgm_file[0]))
@@ -349,14 +543,55 @@ int main(int argc, char *argv[])
         if (strchr(channels, 'n')) ctrl.enable_apu_noise = true;
         if (strchr(channels, 'D')) ctrl.enable_apu_dmc = true;
         if (strchr(channels, 'd')) ctrl.enable_apu_dmc = true;
+        ctrl.keyboard = (0 != strcmp(vgm_file, "-"));
+        ctrl.use_loop_cache = cache_loop;
+        if ((sample_rate < 8000) || (sample_rate > 192000))
+        {
+            ansicon_printf(ANSI_RED, "Sample rate %d out of range 8000..192000\n", sample_rate);
+            break;
+        }
+        ctrl.sample_rate = (unsigned)sample_rate;
+        if (0 == strcasecmp(format, "s16"))
+            ctrl.dump_format = DUMP_S16;
+        else if (0 == strcasecmp(format, "s32"))
+            ctrl.dump_format = DUMP_S32;
+        else if (0 == strcasecmp(format, "f32"))
+            ctrl.dump_format = DUMP_F32;
+        else
+        {
+            ansicon_printf(ANSI_RED, "Unknown sample format %s\n", format);
+            break;
+        }
 
         // Create reader
-        reader = cfreader_create(vgm_file, READER_CACHE_SIZE);
+        if (pack_file)
+        {
+            pack = vpack_open(pack_file);
+            if (!pack)
+            {
+                ansicon_printf(ANSI_RED, "Unable to open pack %s\n", pack_file);
+                break;
+            }
+        }
+        ctrl.vgm_file = vgm_file;
+        ctrl.pack = pack;
+        reader = open_track(&ctrl);
         if (!reader)
         {
             ansicon_printf(ANSI_RED, "Unable to open %s\n", vgm_file);
             break;
         }
+        if (trace_file)
+        {
+            file_reader_t *tracer = trreader_create(reader, trace_file);
+            if (!tracer)
+            {
+                ansicon_printf(ANSI_RED, "Unable to write trace %s\n", trace_file);
+                break;
+            }
+            reader = tracer;
+            ctrl.trace = tracer;
+        }
         // Create decoder
         vgm = vgm_create(reader);
         if (!vgm)
@@ -364,7 +599,8 @@ int main(int argc, char *argv[])
             ansicon_printf(ANSI_RED, "Error parsing vgm file %s\n", vgm_file);
             break;
         }
-        ctrl.complete_samples = vgm->complete_samples;
+        ctrl.complete_samples = output_samples(vgm->complete_samples, ctrl.sample_rate);
+        ctrl.vgm = vgm;
 
         ansicon_printf(ANSI_LIGHTBLUE, "Version        %X.%X\n", vgm->version >> 8, vgm->version & 0xff);
         if (vgm->loop_samples > 0)
@@ -383,7 +619,7 @@ int main(int argc, char *argv[])
         }
         else
         {
-            const char *infile = vgm_file;
+            const char *infile = ctrl.keyboard ? vgm_file : "stdin.vgm";
             char infile_abs[MAX_PATH_NAME];
             char outfile_abs[MAX_PATH_NAME];
             if (cwk_path_is_relative(infile))
@@ -393,16 +629,17 @@ int main(int argc, char *argv[])
                 free(cwd);
                 infile = infile_abs;
             }
-            cwk_path_change_extension(infile_abs, "wav", outfile_abs, MAX_PATH_NAME);
-            dump(vgm, reader, &ctrl, outfile_abs);
+            cwk_path_change_extension(infile, "wav", outfile_abs, MAX_PATH_NAME);
+            r = dump(vgm, reader, &ctrl, outfile_abs);
         }
         printf("\n");
     } while (0);
     
     if (vgm != 0) vgm_destroy(vgm);
-    if (reader != 0) cfreader_destroy(reader);
+    if (reader != 0) freader_close(reader);
+    if (pack != 0) vpack_close(pack);
     
     ansicon_show_cursor();
     ansicon_restore();
-    return 0;
+    return r;
 }
@@ -0,0 +1,674 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <parg.h>
+#include <cwalk.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <direct.h>
+# define strcasecmp _stricmp
+# define mkdir(d,m) _mkdir(d)
+#else
+# include <dirent.h>
+#endif
+
+#include "vgm_conf.h"
+#include "vgm_thread.h"
+#include "reader_factory.h"
+#include "reader_stats.h"
+#include "wav_writer.h"
+#include "vgm.h"
+#ifdef VGM_HAVE_ZLIB
+# include "vgz_file_reader.h"
+#endif
+#ifdef VGM_HAVE_IO_URING
+# include "uring_file_reader.h"
+#endif
+
+// Render many VGM files to WAV on all cores. Every worker has its own reader and decoder.
+// Files are probed for their length first, then handed out longest first so the run does
+// not end waiting for one long track started last. On Linux uncompressed files are read
+// through one io_uring pool shared by all workers, so their read-ahead goes to the disk in
+// batches instead of one blocking read per worker.
+
+
+#define SAMPLE_RATE             44100
+#define RENDER_BUFFER_SAMPLES   4096
+#define READER_MEMORY_BUDGET    (4 * 1024 * 1024)
+#define MAX_PATH_NAME           256
+#define URING_BLOCK_SIZE        65536
+
+#ifndef VGMDEC_VERSION
+# define VGMDEC_VERSION         "unknown"
+#endif
+
+
+typedef struct job_s
+{
+    char* in;
+    char* rel;              // part of input path kept under output directory
+    char* out;
+    unsigned long samples;  // complete_samples from probe, 0 if file can not be decoded
+    int result;
+} job_t;
+
+
+typedef struct render_s
+{
+    job_t* jobs;
+    size_t count;
+    size_t capacity;
+    job_t** order;          // jobs in the order they are handed out
+    const char* out_dir;    // NULL to write next to input
+    bool enable[5];         // NES APU pulse1, pulse2, triangle, noise, dmc
+    bool probe;             // probing lengths, not rendering
+    bool resume;            // keep .wav files completed by an earlier run with the same settings
+    char settings[WAV_COMMENT_MAX]; // render settings, stored in every .wav to tell if it is current
+#ifdef VGM_HAVE_IO_URING
+    urpool_t* pool;         // NULL if io_uring is not available
+#endif
+    // Shared between workers, protected by lock
+    vmutex_t lock;
+    size_t next;
+    size_t done;
+    unsigned long long samples_done;
+} render_t;
+
+
+static void usage()
+{
+    printf("Usage:\n");
+    printf("vgmrender [-jThreads] [-oOutdir] [-cChannels] [-r] path ...\n");
+    printf("path is a .vgm/.vgz file, a directory (searched recursively) or @list with one path per line\n");
+    printf("Options\n");
+    printf("-j  Worker threads, default is number of CPUs\n");
+    printf("-o  Write .wav files to this directory instead of next to input, files found in a\n");
+    printf("    directory keep their path below it\n");
+    printf("-r  Keep .wav files completed by an earlier run with the same settings, render the rest\n");
+    printf("-c  Enable selection of channels:\n");
+    printf("    Channels for NESAPU: DNT21\n");
+}
+
+
+static bool add_job(render_t *ctx, const char *path, const char *rel)
+{
+    if (ctx->count == ctx->capacity)
+    {
+        size_t capacity = ctx->capacity ? ctx->capacity * 2 : 256;
+        job_t *jobs = (job_t *)realloc(ctx->jobs, sizeof(job_t) * capacity);
+        if (0 == jobs)
+            return false;
+        ctx->jobs = jobs;
+        ctx->capacity = capacity;
+    }
+    ctx->jobs[ctx->count].in = (char *)malloc(strlen(path) + 1);
+    if (0 == ctx->jobs[ctx->count].in)
+        return false;
+    strcpy(ctx->jobs[ctx->count].in, path);
+    ctx->jobs[ctx->count].rel = (char *)malloc(strlen(rel) + 1);
+    if (0 == ctx->jobs[ctx->count].rel)
+    {
+        free(ctx->jobs[ctx->count].in);
+        return false;
+    }
+    strcpy(ctx->jobs[ctx->count].rel, rel);
+    ctx->jobs[ctx->count].out = 0;
+    ctx->jobs[ctx->count].samples = 0;
+    ctx->jobs[ctx->count].result = 0;
+    ++ctx->count;
+    return true;
+}
+
+
+static bool is_vgm_file(const char *path)
+{
+    const char *ext;
+    size_t len;
+    if (!cwk_path_get_extension(path, &ext, &len))
+        return false;
+    return (0 == strcasecmp(ext, ".vgm")) || (0 == strcasecmp(ext, ".vgz"));
+}
+
+
+static void add_path(render_t *ctx, const char *path, const char *rel, bool named);
+
+
+// Path of name in dir, name alone if dir is "". Paths which do not fit in MAX_PATH_NAME are
+// reported and refused, cut short they would name another file
+static bool join_path(const char *dir, const char *name, char *out)
+{
+    size_t n;
+    if ('\0' == dir[0])
+        n = (size_t)snprintf(out, MAX_PATH_NAME, "%s", name);
+    else
+        n = cwk_path_join(dir, name, out, MAX_PATH_NAME);
+    if (n < MAX_PATH_NAME)
+        return true;
+    VGM_PRINTERR("Path too long: %s/%s\n", dir, name);
+    return false;
+}
+
+
+// rel is the path of dir below the directory named on command line, "" for that one
+static void scan_dir(render_t *ctx, const char *dir, const char *rel)
+{
+    char path[MAX_PATH_NAME], sub[MAX_PATH_NAME];
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
+    if (!join_path(dir, "*", path))
+        return;
+    h = FindFirstFileA(path, &fd);
+    if (INVALID_HANDLE_VALUE == h)
+        return;
+    do
+    {
+        if ('.' == fd.cFileName[0])
+            continue;
+        // Directory links and junctions are not followed, one pointing up would be scanned forever
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+        if (join_path(dir, fd.cFileName, path) && join_path(rel, fd.cFileName, sub))
+            add_path(ctx, path, sub, false);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    struct dirent *de;
+    DIR *d = opendir(dir);
+    if (0 == d)
+        return;
+    while ((de = readdir(d)) != 0)
+    {
+        if ('.' == de->d_name[0])
+            continue;   // ., .. and hidden entries
+        if (join_path(dir, de->d_name, path) && join_path(rel, de->d_name, sub))
+            add_path(ctx, path, sub, false);
+    }
+    closedir(d);
+#endif
+}
+
+
+// Files named on command line are taken whatever their extension, files found in
+// directories only if they are .vgm or .vgz. rel is 0 for paths named on command line.
+static void add_path(render_t *ctx, const char *path, const char *rel, bool named)
+{
+    struct stat st;
+    const char *base;
+    size_t len;
+#ifdef _WIN32
+    int r = stat(path, &st);
+#else
+    // Links found in directories are checked before following them
+    int r = named ? stat(path, &st) : lstat(path, &st);
+#endif
+    if (0 != r)
+    {
+        VGM_PRINTERR("Unable to find %s\n", path);
+        return;
+    }
+#ifndef _WIN32
+    // Directory links are not followed, one pointing up would be scanned forever
+    if ((S_IFLNK == (st.st_mode & S_IFMT)) && ((0 != stat(path, &st)) || (S_IFDIR == (st.st_mode & S_IFMT))))
+        return;
+#endif
+    if (S_IFDIR == (st.st_mode & S_IFMT))
+        scan_dir(ctx, path, rel ? rel : "");
+    else if (named || is_vgm_file(path))
+    {
+        cwk_path_get_basename(path, &base, &len);
+        add_job(ctx, path, rel ? rel : base);
+    }
+}
+
+
+static void add_list(render_t *ctx, const char *list)
+{
+    char line[MAX_PATH_NAME + 2];   // room for line end
+    FILE *fd = fopen(list, "r");
+    if (0 == fd)
+    {
+        VGM_PRINTERR("Unable to open list %s\n", list);
+        return;
+    }
+    while (fgets(line, sizeof(line), fd))
+    {
+        bool whole = (0 != strchr(line, '\n')) || feof(fd);
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!whole || (strlen(line) >= MAX_PATH_NAME))
+        {
+            VGM_PRINTERR("Path too long in %s: %.40s...\n", list, line);
+            while (!whole && fgets(line, sizeof(line), fd))
+                whole = (0 != strchr(line, '\n'));
+            continue;
+        }
+        if (('\0' != line[0]) && ('#' != line[0]))
+            add_path(ctx, line, 0, true);
+    }
+    fclose(fd);
+}
+
+
+// Normalized so that one file reached by different paths, e.g. a/x.vgm and ./a/x.vgm, gets one
+// name. False if the path does not fit in MAX_PATH_NAME
+static bool output_path(render_t *ctx, const job_t *job, char *out)
+{
+    char name[MAX_PATH_NAME];
+    if (0 == ctx->out_dir)
+    {
+        if (cwk_path_change_extension(job->in, "wav", name, MAX_PATH_NAME) >= MAX_PATH_NAME)
+            return false;
+    }
+    else if ((cwk_path_change_extension(job->rel, "wav", out, MAX_PATH_NAME) >= MAX_PATH_NAME)
+             || (cwk_path_join(ctx->out_dir, out, name, MAX_PATH_NAME) >= MAX_PATH_NAME))
+        return false;
+    return cwk_path_normalize(name, out, MAX_PATH_NAME) < MAX_PATH_NAME;
+}
+
+
+// Both paths name the same file, as far as normalizing them tells
+static bool same_path(const char *a, const char *b)
+{
+    char x[MAX_PATH_NAME], y[MAX_PATH_NAME];
+    if ((cwk_path_normalize(a, x, MAX_PATH_NAME) >= MAX_PATH_NAME) || (cwk_path_normalize(b, y, MAX_PATH_NAME) >= MAX_PATH_NAME))
+        return 0 == strcmp(a, b);
+    return 0 == strcmp(x, y);
+}
+
+
+// Create directories leading to file path below out_dir
+static void make_parent_dirs(render_t *ctx, const char *path)
+{
+    char dir[MAX_PATH_NAME];
+    size_t start = strlen(ctx->out_dir);
+    snprintf(dir, MAX_PATH_NAME, "%s", path);
+    for (size_t i = start + 1; '\0' != dir[i]; ++i)
+    {
+        if (('/' == dir[i]) || ('\\' == dir[i]))
+        {
+            char c = dir[i];
+            dir[i] = '\0';
+            mkdir(dir, 0755);
+            dir[i] = c;
+        }
+    }
+}
+
+
+static int by_output(const void *a, const void *b)
+{
+    const job_t *x = *(const job_t * const *)a, *y = *(const job_t * const *)b;
+    int r = strcmp(x->out, y->out);
+    return r ? r : (x < y) ? -1 : (x > y);
+}
+
+
+// Work out .wav name of every job before workers start. A file given twice is rendered once,
+// two inputs writing the same output are refused, workers would write it at the same time.
+static bool assign_outputs(render_t *ctx)
+{
+    char out[MAX_PATH_NAME];
+    job_t **sorted, *kept;
+    size_t i, n;
+    bool ok = true;
+
+    for (i = 0; i < ctx->count; ++i)
+    {
+        if (!output_path(ctx, ctx->jobs + i, out))
+        {
+            VGM_PRINTERR("Output path too long for %s\n", ctx->jobs[i].in);
+            return false;
+        }
+        ctx->jobs[i].out = (char *)malloc(strlen(out) + 1);
+        if (0 == ctx->jobs[i].out)
+            return false;
+        strcpy(ctx->jobs[i].out, out);
+    }
+    sorted = (job_t **)malloc(sizeof(job_t *) * ctx->count);
+    if (0 == sorted)
+        return false;
+    for (i = 0; i < ctx->count; ++i)
+        sorted[i] = ctx->jobs + i;
+    qsort(sorted, ctx->count, sizeof(job_t *), by_output);
+    for (i = 1, kept = sorted[0]; i < ctx->count; ++i)
+    {
+        if (0 != strcmp(kept->out, sorted[i]->out))
+            kept = sorted[i];
+        else if (same_path(kept->in, sorted[i]->in))
+            sorted[i]->result = 1;      // duplicate, dropped below
+        else
+        {
+            VGM_PRINTERR("%s and %s both render to %s\n", kept->in, sorted[i]->in, sorted[i]->out);
+            ok = false;
+        }
+    }
+    free(sorted);
+    // Drop duplicates, keeping command line order
+    for (i = 0, n = 0; i < ctx->count; ++i)
+    {
+        if (1 == ctx->jobs[i].result)
+        {
+            free(ctx->jobs[i].in);
+            free(ctx->jobs[i].rel);
+            free(ctx->jobs[i].out);
+            continue;
+        }
+        ctx->jobs[n++] = ctx->jobs[i];
+    }
+    ctx->count = n;
+    return ok;
+}
+
+
+static file_reader_t * open_reader(render_t *ctx, const char *fn)
+{
+#ifdef VGM_HAVE_IO_URING
+    file_reader_t *reader;
+    bool compressed = false;
+# ifdef VGM_HAVE_ZLIB
+    compressed = vgzreader_probe(fn);
+# endif
+    if (ctx->pool && !compressed)
+    {
+        reader = urpool_reader_create(ctx->pool, fn, URING_BLOCK_SIZE);
+        if (reader)
+            return reader;
+    }
+#else
+    (void)ctx;
+#endif
+    return freader_open(fn, READER_MEMORY_BUDGET, 0);
+}
+
+
+// Queued read-ahead of all workers goes to the disk together
+static void submit_reads(render_t *ctx)
+{
+#ifdef VGM_HAVE_IO_URING
+    if (ctx->pool)
+        urpool_submit(ctx->pool);
+#else
+    (void)ctx;
+#endif
+}
+
+
+static void probe(render_t *ctx, job_t *job)
+{
+    file_reader_t *reader = open_reader(ctx, job->in);
+    vgm_t *vgm = reader ? vgm_create(reader) : 0;
+    job->samples = vgm ? vgm->complete_samples : 0;
+    job->result = vgm ? 0 : -1;
+    if (vgm) vgm_destroy(vgm);
+    if (reader) freader_close(reader);
+}
+
+
+// Output of an earlier run with all samples and the same settings
+static bool is_complete(render_t *ctx, const char *out, unsigned long samples)
+{
+    FILE *fd = fopen(out, "rb");
+    bool r = fd && wav_is_complete(fd, WAV_FORMAT_PCM, SAMPLE_RATE, 1, 16, samples, ctx->settings);
+    if (fd) fclose(fd);
+    return r;
+}
+
+
+// Returns 0 when rendered, 1 when out was already complete and left alone, -1 on failure
+static int render(render_t *ctx, job_t *job, const char *out, unsigned long *played)
+{
+    int16_t buffer[RENDER_BUFFER_SAMPLES];
+    file_reader_t *reader = 0;
+    vgm_t *vgm = 0;
+    FILE *fd = 0;
+    int r = -1;
+
+    *played = 0;
+    do
+    {
+        if (ctx->resume && is_complete(ctx, out, job->samples))
+        {
+            r = 1;      // finished by an earlier run
+            break;
+        }
+        reader = open_reader(ctx, job->in);
+        if (0 == reader)
+            break;
+        vgm = vgm_create(reader);
+        if (0 == vgm)
+            break;
+        fd = fopen(out, "wb");
+        if (0 == fd)
+            break;
+        setvbuf(fd, NULL, _IOFBF, 65536);
+        if (!wav_write_header(fd, WAV_FORMAT_PCM, SAMPLE_RATE, 1, 16, vgm->complete_samples))
+            break;
+
+        vgm_prepare_playback(vgm, SAMPLE_RATE, false);
+        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_ALL, false);
+        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE1, ctx->enable[0]);
+        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_PULSE2, ctx->enable[1]);
+        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_TRIANGLE, ctx->enable[2]);
+        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_NOISE, ctx->enable[3]);
+        vgm_nesapu_enable_channel(vgm, VGM_NESAPU_CHANNEL_DMC, ctx->enable[4]);
+        while (*played < vgm->complete_samples)
+        {
+            int n = vgm_get_samples(vgm, buffer, RENDER_BUFFER_SAMPLES);
+            if (n <= 0)
+                break;
+            submit_reads(ctx);
+            if (fwrite(buffer, sizeof(int16_t), (size_t)n, fd) != (size_t)n)
+                break;
+            *played += (unsigned long)n;
+        }
+        if (*played != vgm->complete_samples)
+        {
+            // Keep what was rendered playable, without settings it is rendered again by -r
+            wav_update_header(fd, WAV_FORMAT_PCM, SAMPLE_RATE, 1, 16, *played);
+            break;
+        }
+        if (!wav_append_comment(fd, ctx->settings))
+            break;
+        r = 0;
+    } while (0);
+
+    if (fd && (0 != fclose(fd)))
+        r = -1;
+    if (vgm) vgm_destroy(vgm);
+    if (reader) freader_close(reader);
+    return r;
+}
+
+
+VTHREAD_FUNC(worker, arg)
+{
+    render_t *ctx = (render_t *)arg;
+    unsigned long played;
+    int r;
+    job_t *job;
+
+    while (1)
+    {
+        vmutex_lock(&ctx->lock);
+        job = (ctx->next < ctx->count) ? ctx->order[ctx->next++] : 0;
+        vmutex_unlock(&ctx->lock);
+        if (0 == job)
+            break;
+
+        if (ctx->probe)
+        {
+            probe(ctx, job);
+            continue;
+        }
+        if (0 != job->result)
+            continue;   // not decodable, reported after probing
+        if (ctx->out_dir)
+            make_parent_dirs(ctx, job->out);
+        r = render(ctx, job, job->out, &played);
+        job->result = (r < 0) ? -1 : 0;
+
+        vmutex_lock(&ctx->lock);
+        ++ctx->done;
+        ctx->samples_done += played;
+        printf("[%lu] %s %s (%.1fs)\n", (unsigned long)ctx->done, (r > 0) ? "kept  " : ((0 == r) ? "ok    " : "FAILED"), job->out, (double)played / SAMPLE_RATE);
+        fflush(stdout);
+        vmutex_unlock(&ctx->lock);
+    }
+    VTHREAD_RETURN;
+}
+
+
+// Run worker on threads until every job in order is taken
+static void run(render_t *ctx, int threads)
+{
+    vthread_t *t = (vthread_t *)malloc(sizeof(vthread_t) * (size_t)threads);
+    int started = 0;
+    ctx->next = 0;
+    if (t)
+    {
+        for (started = 0; started < threads; ++started)
+        {
+            if (0 != vthread_create(t + started, worker, ctx))
+                break;
+        }
+    }
+    if (0 == started)
+        worker(ctx);    // no thread available, do it here
+    for (int i = 0; i < started; ++i)
+        vthread_join(t[i]);
+    free(t);
+}
+
+
+static int longest_first(const void *a, const void *b)
+{
+    const job_t *x = *(const job_t * const *)a, *y = *(const job_t * const *)b;
+    if (x->samples != y->samples)
+        return (x->samples < y->samples) ? 1 : -1;
+    return strcmp(x->in, y->in);
+}
+
+
+int main(int argc, char *argv[])
+{
+    render_t ctx;
+    const char *channels = "DNT21";
+    int threads = vthread_cpu_count();
+    int failed = 0, undecodable = 0;
+    uint64_t t0;
+    double sec;
+
+    memset(&ctx, 0, sizeof(render_t));
+
+    // Parse command line options
+    struct parg_state ps;
+    int c;
+    parg_init(&ps);
+    while ((c = parg_getopt(&ps, argc, argv, "j:o:c:rh")) != -1)
+    {
+        switch (c)
+        {
+        case 1:
+            if ('@' == ps.optarg[0])
+                add_list(&ctx, ps.optarg + 1);
+            else
+                add_path(&ctx, ps.optarg, 0, true);
+            break;
+        case 'j':
+            threads = atoi(ps.optarg);
+            break;
+        case 'o':
+            ctx.out_dir = ps.optarg;
+            break;
+        case 'c':
+            channels = ps.optarg;
+            break;
+        case 'r':
+            ctx.resume = true;
+            break;
+        case 'h':
+            usage();
+            return 0;
+        }
+    }
+    if (0 == ctx.count)
+    {
+        usage();
+        return -1;
+    }
+    if (!assign_outputs(&ctx))
+        return -1;
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > ctx.count)
+        threads = (int)ctx.count;
+    ctx.enable[0] = (0 != strchr(channels, '1'));
+    ctx.enable[1] = (0 != strchr(channels, '2'));
+    ctx.enable[2] = (0 != strchr(channels, 'T')) || (0 != strchr(channels, 't'));
+    ctx.enable[3] = (0 != strchr(channels, 'N')) || (0 != strchr(channels, 'n'));
+    ctx.enable[4] = (0 != strchr(channels, 'D')) || (0 != strchr(channels, 'd'));
+    snprintf(ctx.settings, WAV_COMMENT_MAX, "vgmrender %s, %d Hz mono s16, no loop, NES APU channels %s%s%s%s%s",
+        VGMDEC_VERSION, SAMPLE_RATE, ctx.enable[0] ? "1" : "", ctx.enable[1] ? "2" : "", ctx.enable[2] ? "T" : "",
+        ctx.enable[3] ? "N" : "", ctx.enable[4] ? "D" : "");
+    if (ctx.out_dir)
+        mkdir(ctx.out_dir, 0755);
+
+    ctx.order = (job_t **)malloc(sizeof(job_t *) * ctx.count);
+    if (0 == ctx.order)
+        return -1;
+    for (size_t i = 0; i < ctx.count; ++i)
+        ctx.order[i] = ctx.jobs + i;
+    vmutex_init(&ctx.lock);
+#ifdef VGM_HAVE_IO_URING
+    // Two blocks in flight per worker keeps each one reading ahead, a round over all workers
+    // is submitted together
+    ctx.pool = urpool_create(2 * (unsigned)threads, (unsigned)threads);
+#endif
+    t0 = reader_stats_clock();
+
+    // Probe lengths in parallel, then render longest first
+    ctx.probe = true;
+    run(&ctx, threads);
+    for (size_t i = 0; i < ctx.count; ++i)
+    {
+        if (0 != ctx.jobs[i].result)
+        {
+            VGM_PRINTERR("Error parsing vgm file %s\n", ctx.jobs[i].in);
+            ++undecodable;
+        }
+    }
+    qsort(ctx.order, ctx.count, sizeof(job_t *), longest_first);
+    printf("%lu files, %d threads", (unsigned long)(ctx.count - (size_t)undecodable), threads);
+#ifdef VGM_HAVE_IO_URING
+    if (ctx.pool)
+        printf(", io_uring");
+#endif
+    printf("\n");
+    ctx.probe = false;
+    run(&ctx, threads);
+
+    for (size_t i = 0; i < ctx.count; ++i)
+    {
+        if (0 != ctx.jobs[i].result)
+            ++failed;
+        free(ctx.jobs[i].in);
+        free(ctx.jobs[i].rel);
+        free(ctx.jobs[i].out);
+    }
+    sec = (double)(reader_stats_clock() - t0) / 1e9;
+    printf("%lu rendered, %d failed, %.1fs audio in %.1fs (%.1fx realtime)\n",
+        (unsigned long)(ctx.count - (size_t)failed), failed, (double)ctx.samples_done / SAMPLE_RATE, sec,
+        (sec > 0) ? (double)ctx.samples_done / SAMPLE_RATE / sec : 0.0);
+
+#ifdef VGM_HAVE_IO_URING
+    urpool_destroy(ctx.pool);
+#endif
+    vmutex_destroy(&ctx.lock);
+    free(ctx.order);
+    free(ctx.jobs);
+    return failed ? -1 : 0;
+}
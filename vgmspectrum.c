@@ -3,45 +3,51 @@
 #include <math.h>
 #include <SDL.h>
 #include "vgm_conf.h"
-#include "cached_file_reader.h"
+#include "reader_factory.h"
+#include "reader_stats.h"
 #include "vgm.h"
 #include "fft_q15.h"
 
 #define SDL_BUFFER_SIZE 2048
-#define READER_CACHE_SIZE 4096
+#define READER_MEMORY_BUDGET (4 * 1024 * 1024)
 #define SAMPLE_RATE 44100
 
 
-static int16_t buffer[SDL_BUFFER_SIZE];
-static Uint32 buffer_ready_event_type;
+typedef struct spectrum_ctx_s
+{
+    vgm_t *vgm;
+    Uint32 event_type;              // posted when snapshot is ready
+    SDL_atomic_t pending;           // snapshot not drawn yet, callback leaves it alone
+    int16_t snapshot[SDL_BUFFER_SIZE];
+} spectrum_ctx_t;
+
 
+// Decoder renders straight into device buffer, a copy is taken for the FFT only when the
+// previous one has been drawn
 void sdl_audio_callback(void* user, Uint8* stream, int len)
 {
+    spectrum_ctx_t *ctx = (spectrum_ctx_t *)user;
+    int16_t *out = (int16_t *)stream;
     unsigned int samples = (unsigned int)(len / 2); // len is in byte, each sample is 2 bytes
     if (samples > 0)
     {
-        int r = vgm_get_samples((vgm_t*)user, buffer, samples);
-        if (r == samples)   // all sampels are received
+        int r = vgm_get_samples(ctx->vgm, out, samples);
+        if (r < 0)
+            r = 0;
+        SDL_memset(out + r, 0, (size_t)len - (size_t)r * 2);   // silence after end of track
+        if (SDL_AtomicCAS(&ctx->pending, 0, 1))
         {
-            SDL_memcpy(stream, (void *)buffer, (size_t)len);
+            // Get a copy of data to main loop
+            SDL_memcpy(ctx->snapshot, out, (size_t)len);
+            SDL_Event e;
+            SDL_memset(&e, 0, sizeof(e));
+            e.type = ctx->event_type;
+            e.user.code = 0;
+            e.user.data1 = (void*)ctx->snapshot;
+            e.user.data2 = (void*)(intptr_t)r;
+            if (SDL_PushEvent(&e) <= 0)
+                SDL_AtomicSet(&ctx->pending, 0);
         }
-        else if (r > 0)     // not all samples are received
-        {
-            SDL_memset(stream, 0, (size_t)len);
-            SDL_memcpy(stream, (void *)buffer, (size_t)(r * 2));
-        }
-        else
-        {
-            SDL_memset(stream, 0, (size_t)len);
-        }
-        // Get a copy of data to main loop
-        SDL_Event e;
-        SDL_memset(&e, 0, sizeof(e));
-        e.type = buffer_ready_event_type;
-        e.user.code = 0;
-        e.user.data1 = (void*)buffer;
-        e.user.data2 = (void*)(intptr_t)r;
-        SDL_PushEvent(&e);
     }
 }
 
@@ -119,6 +125,7 @@ int main(int argc, char *argv[])
     SDL_Window *screen = NULL;
     SDL_Renderer *renderer = NULL;
     SDL_Event event;
+    spectrum_ctx_t ctx;
     int quit = 0;
 
     if (argc < 2)
@@ -130,7 +137,7 @@ int main(int argc, char *argv[])
     do
     {
         // Create reader
-        reader = cfreader_create(argv[1], READER_CACHE_SIZE);
+        reader = freader_open(argv[1], READER_MEMORY_BUDGET, FREADER_STREAM);
         if (!reader)
         {
             fprintf(stderr, "Unable to open %s\n", argv[1]);
@@ -148,7 +155,9 @@ int main(int argc, char *argv[])
             fprintf(stderr, "SDL initialize error\n");
             break;
         }
-        buffer_ready_event_type = SDL_RegisterEvents(1);
+        SDL_zero(ctx);
+        ctx.vgm = vgm;
+        ctx.event_type = SDL_RegisterEvents(1);
         // SDL Audio
         SDL_AudioSpec want, have;
         SDL_zero(want);
@@ -157,7 +166,7 @@ int main(int argc, char *argv[])
         want.channels = 1;
         want.samples = SDL_BUFFER_SIZE;
         want.callback = sdl_audio_callback;
-        want.userdata = (void*)vgm;
+        want.userdata = (void*)&ctx;
         audio_id = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
         if (0 == audio_id)
         {
@@ -202,7 +211,7 @@ int main(int argc, char *argv[])
                     quit = 1;
                     break;
                 default:
-                    if (event.type == buffer_ready_event_type)
+                    if (event.type == ctx.event_type)
                     {
                         int16_t* buf = (int16_t*)event.user.data1;
                         int l = (int)(intptr_t)event.user.data2;
@@ -212,17 +221,23 @@ int main(int argc, char *argv[])
                             quit = 1;
                         }
                         draw_spectrum(renderer, buf, l);
+                        SDL_AtomicSet(&ctx.pending, 0);
                     }
                     break;
                 }
             }
         }
-        cfreader_show_cache_status(reader);
+        if (reader->stats)
+        {
+            reader_stats_t st;
+            reader->stats(reader, &st);
+            reader_stats_print(&st);
+        }
     } while (0);
     if (screen) SDL_DestroyWindow(screen);
     if (audio_id != 0) SDL_CloseAudioDevice(audio_id);
     SDL_Quit();
     if (vgm != 0) vgm_destroy(vgm);
-    if (reader != 0) cfreader_destroy(reader);
+    if (reader != 0) freader_close(reader);
     return 0;
 }
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <zlib.h>
+#include "vgm_conf.h"
+#include "vgz_file_reader.h"
+#include "reader_stats.h"
+
+
+#define VGZ_WINDOW_SIZE     32768   // deflate dictionary size
+#define VGZ_INPUT_SIZE      16384   // compressed input buffer
+
+
+// Checkpoint to resume inflate from, zran style
+typedef struct vgz_point_s
+{
+    size_t out;             // uncompressed offset
+    size_t in;              // compressed offset of first complete byte
+    int bits;               // bits of the byte before in belonging to this point (0-7)
+    uint8_t* window;        // VGZ_WINDOW_SIZE bytes of output preceding out
+} vgz_point_t;
+
+
+// Gzip File Reader
+typedef struct vgzr_s
+{
+    // super class
+    file_reader_t super;
+    // Private fields
+    FILE* fd;
+    z_stream strm;
+    bool stream_end;
+    size_t in_pos;          // compressed offset of next byte to load into input
+    size_t out_pos;         // uncompressed bytes produced so far
+    size_t size;            // uncompressed size from gzip trailer
+    size_t span;
+    size_t pos;
+    vgz_point_t* points;
+    size_t points_count;
+    size_t points_alloc;
+    reader_stats_t stats;
+    uint8_t input[VGZ_INPUT_SIZE];
+    uint8_t window[VGZ_WINDOW_SIZE];    // ring buffer, uncompressed byte n is at window[n % VGZ_WINDOW_SIZE]
+} vgzr_t;
+
+
+// Copy output preceding out_pos from ring buffer to linear buffer
+static void save_window(vgzr_t *ctx, uint8_t *dst)
+{
+    size_t head = ctx->out_pos % VGZ_WINDOW_SIZE;
+    memcpy(dst, ctx->window + head, VGZ_WINDOW_SIZE - head);
+    memcpy(dst + VGZ_WINDOW_SIZE - head, ctx->window, head);
+}
+
+
+static void add_point(vgzr_t *ctx)
+{
+    vgz_point_t *p;
+    if (ctx->points_count == ctx->points_alloc)
+    {
+        size_t alloc = ctx->points_alloc ? ctx->points_alloc * 2 : 16;
+        p = (vgz_point_t*)VGM_MALLOC(sizeof(vgz_point_t) * alloc);
+        if (0 == p)
+            return;
+        if (ctx->points_count > 0)
+            memcpy(p, ctx->points, sizeof(vgz_point_t) * ctx->points_count);
+        if (ctx->points)
+            VGM_FREE(ctx->points);
+        ctx->points = p;
+        ctx->points_alloc = alloc;
+    }
+    p = ctx->points + ctx->points_count;
+    p->window = (uint8_t*)VGM_MALLOC(VGZ_WINDOW_SIZE);
+    if (0 == p->window)
+        return;
+    p->out = ctx->out_pos;
+    p->in = ctx->in_pos - ctx->strm.avail_in;
+    p->bits = ctx->strm.data_type & 7;
+    save_window(ctx, p->window);
+    ++ctx->points_count;
+}
+
+
+// Start inflating from beginning of file
+static bool restart(vgzr_t *ctx)
+{
+    if (inflateReset2(&ctx->strm, 47) != Z_OK)  // auto detect gzip/zlib header
+        return false;
+    ++ctx->stats.io_seeks;
+    if (fseek(ctx->fd, 0, SEEK_SET) != 0)
+        return false;
+    ctx->strm.avail_in = 0;
+    ctx->in_pos = 0;
+    ctx->out_pos = 0;
+    ctx->stream_end = false;
+    return true;
+}
+
+
+// Resume inflating at checkpoint, output preceding checkpoint becomes available in ring buffer
+static bool resume(vgzr_t *ctx, vgz_point_t *p)
+{
+    size_t head;
+    int c = 0;
+    if (inflateReset2(&ctx->strm, -15) != Z_OK)     // raw deflate
+        return false;
+    ++ctx->stats.io_seeks;
+    if (fseek(ctx->fd, (long)(p->in - (p->bits ? 1 : 0)), SEEK_SET) != 0)
+        return false;
+    if (p->bits)
+    {
+        ++ctx->stats.io_reads;
+        c = fgetc(ctx->fd);
+        if (EOF == c)
+            return false;
+        inflatePrime(&ctx->strm, p->bits, c >> (8 - p->bits));
+    }
+    if (p->out >= VGZ_WINDOW_SIZE)
+        inflateSetDictionary(&ctx->strm, p->window, VGZ_WINDOW_SIZE);
+    else
+        inflateSetDictionary(&ctx->strm, p->window + VGZ_WINDOW_SIZE - p->out, (uInt)p->out);
+    ctx->strm.avail_in = 0;
+    ctx->in_pos = p->in;
+    ctx->out_pos = p->out;
+    ctx->stream_end = false;
+    head = p->out % VGZ_WINDOW_SIZE;
+    memcpy(ctx->window + head, p->window, VGZ_WINDOW_SIZE - head);
+    memcpy(ctx->window, p->window + VGZ_WINDOW_SIZE - head, head);
+    return true;
+}
+
+
+// Inflate next piece of output into ring buffer, return bytes produced
+static size_t inflate_more(vgzr_t *ctx)
+{
+    size_t head, produced = 0;
+    int ret;
+    while ((0 == produced) && !ctx->stream_end)
+    {
+        if (0 == ctx->strm.avail_in)
+        {
+            uint64_t t = reader_stats_clock();
+            size_t got = fread(ctx->input, 1, VGZ_INPUT_SIZE, ctx->fd);
+            ctx->stats.io_ns += reader_stats_clock() - t;
+            ++ctx->stats.io_reads;
+            if (0 == got)
+                break;      // truncated file
+            ctx->in_pos += got;
+            ctx->strm.next_in = ctx->input;
+            ctx->strm.avail_in = (uInt)got;
+        }
+        head = ctx->out_pos % VGZ_WINDOW_SIZE;
+        ctx->strm.next_out = ctx->window + head;
+        ctx->strm.avail_out = (uInt)(VGZ_WINDOW_SIZE - head);
+        // Stop at every deflate block boundary so checkpoints can be recorded
+        ret = inflate(&ctx->strm, Z_BLOCK);
+        if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR))
+        {
+            VGM_PRINTERR("vgz: inflate error %d\n", ret);
+            ctx->stream_end = true;
+            break;
+        }
+        produced = VGZ_WINDOW_SIZE - head - ctx->strm.avail_out;
+        ctx->out_pos += produced;
+        if (Z_STREAM_END == ret)
+        {
+            ctx->stream_end = true;
+        }
+        else if ((ctx->strm.data_type & 128) && !(ctx->strm.data_type & 64))
+        {
+            // Block boundary, not at end of last block
+            size_t last = ctx->points_count ? ctx->points[ctx->points_count - 1].out : 0;
+            if (ctx->out_pos >= last + ctx->span)
+                add_point(ctx);
+        }
+    }
+    return produced;
+}
+
+
+static size_t vgzr_read(file_reader_t *self, uint8_t *out, size_t offset, size_t length)
+{
+    vgzr_t *ctx = (vgzr_t *)self;
+    size_t total = 0, start, temp, i, requested = length, first;
+    size_t cached_end = ctx->out_pos;   // output available before this call
+
+    if ((size_t)-1 == offset)
+        offset = ctx->pos;
+    first = offset;
+
+    while (length > 0)
+    {
+        start = (ctx->out_pos > VGZ_WINDOW_SIZE) ? ctx->out_pos - VGZ_WINDOW_SIZE : 0;
+        if ((offset >= start) && (offset < ctx->out_pos))
+        {
+            // Available in ring buffer, copy up to ring wrap or end of output
+            temp = ctx->out_pos - offset;
+            if (temp > VGZ_WINDOW_SIZE - offset % VGZ_WINDOW_SIZE)
+                temp = VGZ_WINDOW_SIZE - offset % VGZ_WINDOW_SIZE;
+            if (temp > length)
+                temp = length;
+            memcpy(out, ctx->window + offset % VGZ_WINDOW_SIZE, temp);
+            ctx->stats.bytes_copied += temp;
+            if (offset < cached_end)
+                ctx->stats.cache_hit += temp;
+            else
+                ctx->stats.cache_miss += temp;
+            total += temp;
+            out += temp;
+            offset += temp;
+            length -= temp;
+        }
+        else if (offset >= ctx->out_pos)
+        {
+            if ((offset >= ctx->size) || (0 == inflate_more(ctx)))
+                break;
+        }
+        else
+        {
+            // Behind ring buffer, go back to the last checkpoint before offset
+            for (i = ctx->points_count; i > 0; --i)
+            {
+                if (ctx->points[i - 1].out <= offset)
+                    break;
+            }
+            if (!((i > 0) ? resume(ctx, ctx->points + i - 1) : restart(ctx)))
+                break;
+            cached_end = ctx->out_pos;  // restored dictionary is in ring buffer now
+        }
+    }
+    ctx->pos = offset;
+    reader_stats_count_read(&ctx->stats, first, requested, total);
+    return total;
+}
+
+
+static size_t vgzr_size(file_reader_t *self)
+{
+    vgzr_t *ctx = (vgzr_t *)self;
+    return ctx ? ctx->size : 0;
+}
+
+
+static void vgzr_stats(file_reader_t *self, reader_stats_t *out)
+{
+    *out = ((vgzr_t *)self)->stats;
+}
+
+
+bool vgzreader_probe(const char* fn)
+{
+    uint8_t magic[2];
+    FILE *fd = fopen(fn, "rb");
+    if (0 == fd)
+        return false;
+    size_t got = fread(magic, 1, 2, fd);
+    fclose(fd);
+    return (2 == got) && (0x1f == magic[0]) && (0x8b == magic[1]);
+}
+
+
+file_reader_t * vgzreader_create(const char* fn, size_t span)
+{
+    vgzr_t *ctx;
+    uint8_t trailer[4];
+
+    if (span < VGZ_WINDOW_SIZE)
+        span = VGZ_WINDOW_SIZE;
+
+    ctx = (vgzr_t*)VGM_MALLOC(sizeof(vgzr_t));
+    if (0 == ctx)
+        return 0;
+    memset(ctx, 0, sizeof(vgzr_t));
+
+    do
+    {
+        ctx->fd = fopen(fn, "rb");
+        if (0 == ctx->fd)
+            break;
+        // Uncompressed size (mod 2^32) is stored in last 4 bytes of gzip file
+        if ((fseek(ctx->fd, -4, SEEK_END) != 0) || (fread(trailer, 1, 4, ctx->fd) != 4))
+            break;
+        ctx->size = (size_t)trailer[0] | ((size_t)trailer[1] << 8) | ((size_t)trailer[2] << 16) | ((size_t)trailer[3] << 24);
+        if (inflateInit2(&ctx->strm, 47) != Z_OK)
+            break;
+        if (!restart(ctx))
+        {
+            inflateEnd(&ctx->strm);
+            break;
+        }
+        ctx->span = span;
+
+        ctx->super.self = (file_reader_t*)ctx;
+        ctx->super.read = vgzr_read;
+        ctx->super.size = vgzr_size;
+        ctx->super.borrow = 0;
+        ctx->super.destroy = vgzreader_destroy;
+        ctx->super.stats = vgzr_stats;
+        ctx->super.readv = 0;
+
+        return (file_reader_t*)ctx;
+
+    } while (0);
+
+    if (ctx->fd)
+        fclose(ctx->fd);
+    VGM_FREE(ctx);
+    return 0;
+}
+
+
+void vgzreader_destroy(file_reader_t *vgzr)
+{
+    vgzr_t* ctx = (vgzr_t*)vgzr;
+    if (0 == ctx)
+        return;
+    for (size_t i = 0; i < ctx->points_count; ++i)
+        VGM_FREE(ctx->points[i].window);
+    if (ctx->points)
+        VGM_FREE(ctx->points);
+    inflateEnd(&ctx->strm);
+    fclose(ctx->fd);
+    VGM_FREE(ctx);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include "file_reader.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Gzip compressed (.vgz) file reader. Data is inflated on the fly. While inflating, a
+// checkpoint (deflate block boundary + 32 KB dictionary) is recorded every span bytes of
+// output, so reading backward resumes from the nearest checkpoint instead of the start.
+// The last 32 KB of output is kept, short backward reads are served from it directly.
+
+file_reader_t * vgzreader_create(const char* fn, size_t span);
+
+void vgzreader_destroy(file_reader_t* vgzr);
+
+// Check gzip magic of file
+bool vgzreader_probe(const char* fn);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "wav_writer.h"
+
+
+static uint32_t get_u16(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | (get_u16(p + 2) << 16);
+}
+
+
+static void put_u16(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+
+bool wav_write_header(FILE* fd, unsigned format, unsigned sample_rate, unsigned channels, unsigned bits, unsigned long frames)
+{
+    uint8_t h[WAV_HEADER_SIZE];
+    uint32_t block_align = channels * bits / 8;
+    uint32_t data_size = (uint32_t)(frames * block_align);
+
+    memcpy(h, "RIFF", 4);
+    put_u32(h + 4, WAV_HEADER_SIZE - 8 + data_size);    // chunk size
+    memcpy(h + 8, "WAVE", 4);
+    memcpy(h + 12, "fmt ", 4);
+    put_u32(h + 16, 16);                                // fmt chunk size
+    put_u16(h + 20, format);
+    put_u16(h + 22, channels);
+    put_u32(h + 24, sample_rate);
+    put_u32(h + 28, sample_rate * block_align);         // byte rate
+    put_u16(h + 32, block_align);
+    put_u16(h + 34, bits);
+    memcpy(h + 36, "data", 4);
+    put_u32(h + 40, data_size);
+    return fwrite(h, 1, WAV_HEADER_SIZE, fd) == WAV_HEADER_SIZE;
+}
+
+
+bool wav_update_header(FILE* fd, unsigned format, unsigned sample_rate, unsigned channels, unsigned bits, unsigned long frames)
+{
+    bool r;
+    if (0 != fseek(fd, 0, SEEK_SET))
+        return false;
+    r = wav_write_header(fd, format, sample_rate, channels, bits, frames);
+    fseek(fd, 0, SEEK_END);
+    return r;
+}
+
+
+bool wav_append_comment(FILE* fd, const char* text)
+{
+    static const uint8_t zero[2] = { 0, 0 };
+    uint8_t h[20];
+    uint32_t len = (uint32_t)strlen(text) + 1;
+    uint32_t padded = (len + 1) & ~1u;
+    long size;
+    bool r;
+    if ((len > WAV_COMMENT_MAX) || (0 != fseek(fd, 0, SEEK_END)) || ((size = ftell(fd)) < WAV_HEADER_SIZE))
+        return false;
+    // Chunks start at even offsets, odd sized data is padded
+    if ((size & 1) && (fwrite(zero, 1, 1, fd) != 1))
+        return false;
+    memcpy(h, "LIST", 4);
+    put_u32(h + 4, 4 + 8 + padded);
+    memcpy(h + 8, "INFO", 4);
+    memcpy(h + 12, "ICMT", 4);
+    put_u32(h + 16, len);
+    if ((fwrite(h, 1, sizeof(h), fd) != sizeof(h)) || (fwrite(text, 1, len, fd) != len)
+        || (fwrite(zero, 1, padded - len, fd) != padded - len))
+        return false;
+    // RIFF size covering the comment goes last, a file cut before has none
+    if (((size = ftell(fd)) < 0) || (0 != fseek(fd, 4, SEEK_SET)))
+        return false;
+    put_u32(h, (uint32_t)(size - 8));
+    r = fwrite(h, 1, 4, fd) == 4;
+    fseek(fd, 0, SEEK_END);
+    return r;
+}
+
+
+bool wav_is_complete(FILE* fd, unsigned format, unsigned sample_rate, unsigned channels, unsigned bits, unsigned long frames, const char* text)
+{
+    uint8_t h[WAV_HEADER_SIZE];
+    char comment[WAV_COMMENT_MAX];
+    uint32_t data_size = (uint32_t)(frames * (channels * bits / 8));
+    uint32_t list = WAV_HEADER_SIZE + data_size + (data_size & 1);
+    uint32_t len = (uint32_t)strlen(text) + 1;
+    uint32_t padded = (len + 1) & ~1u;
+    if (len > WAV_COMMENT_MAX)
+        return false;
+    if ((0 != fseek(fd, 0, SEEK_SET)) || (fread(h, 1, WAV_HEADER_SIZE, fd) != WAV_HEADER_SIZE))
+        return false;
+    if ((0 != memcmp(h, "RIFF", 4)) || (0 != memcmp(h + 8, "WAVE", 4)) || (0 != memcmp(h + 12, "fmt ", 4))
+        || (0 != memcmp(h + 36, "data", 4)))
+        return false;
+    if ((get_u16(h + 20) != format) || (get_u16(h + 22) != channels) || (get_u32(h + 24) != sample_rate)
+        || (get_u16(h + 34) != bits) || (get_u32(h + 40) != data_size) || (get_u32(h + 4) != list + 20 + padded - 8))
+        return false;
+    if ((0 != fseek(fd, (long)list, SEEK_SET)) || (fread(h, 1, 20, fd) != 20))
+        return false;
+    if ((0 != memcmp(h, "LIST", 4)) || (get_u32(h + 4) != 4 + 8 + padded) || (0 != memcmp(h + 8, "INFO", 4))
+        || (0 != memcmp(h + 12, "ICMT", 4)) || (get_u32(h + 16) != len))
+        return false;
+    return (fread(comment, 1, len, fd) == len) && (0 == memcmp(comment, text, len));
+}
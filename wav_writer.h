@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// WAV file header, fields are written little endian regardless of host.
+// Based on: https://docs.fileformat.com/audio/wav/
+
+#define WAV_HEADER_SIZE     44
+
+#define WAV_FORMAT_PCM      1   // integer samples
+#define WAV_FORMAT_FLOAT    3   // IEEE float, 32 bits
+
+// Write header for PCM data of frames sample frames at current position of fd
+bool wav_write_header(FILE* fd, unsigned format, unsigned sample_rate, unsigned channels, unsigned bits, unsigned long frames);
+
+// Rewrite header at start of fd when the frame count turned out different, e.g. rendering
+// stopped early. File position is left at end of data
+bool wav_update_header(FILE* fd, unsigned format, unsigned sample_rate, unsigned channels, unsigned bits, unsigned long frames);
+
+// Longest comment, with terminating NUL
+#define WAV_COMMENT_MAX     256
+
+// Append a LIST/INFO chunk holding text as comment (ICMT) after the data and fix the RIFF size,
+// which is written last. File position is left at end of file
+bool wav_append_comment(FILE* fd, const char* text);
+
+// Check fd starts with a header of this format for exactly frames frames of data, followed by the
+// comment text added by wav_append_comment(). A file cut short or written with another comment,
+// e.g. other settings, fails the check
+bool wav_is_complete(FILE* fd, unsigned format, unsigned sample_rate, unsigned channels, unsigned bits, unsigned long frames, const char* text);
+
+
+#ifdef __cplusplus
+}
+#endif